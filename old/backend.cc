@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+#include "backend.hh"
+
+using namespace goat;
+using namespace goat::backend;
+
+namespace {
+std::once_flag initialised;
+
+// A machine for every task, they aren't safe to share. The CPU is generic so
+// the output doesn't depend on the host either.
+std::unique_ptr<llvm::TargetMachine> machine(const std::string &triple,
+                                             unsigned level,
+                                             std::string &error) {
+  auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if(target == nullptr) {
+    return nullptr;
+  }
+  llvm::CodeGenOpt::Level levels[] = {
+    llvm::CodeGenOpt::None,
+    llvm::CodeGenOpt::Less,
+    llvm::CodeGenOpt::Default,
+    llvm::CodeGenOpt::Aggressive
+  };
+  return std::unique_ptr<llvm::TargetMachine>(
+    target->createTargetMachine(triple, "generic", "", llvm::TargetOptions(),
+                                llvm::Reloc::PIC_, llvm::None,
+                                levels[std::min(level, 3u)]));
+}
+
+void optimise(llvm::Module &module,
+              llvm::TargetMachine &target,
+              unsigned level) {
+  llvm::LoopAnalysisManager loops;
+  llvm::FunctionAnalysisManager functions;
+  llvm::CGSCCAnalysisManager cgscc;
+  llvm::ModuleAnalysisManager modules;
+  llvm::PassBuilder builder(&target);
+  builder.registerModuleAnalyses(modules);
+  builder.registerCGSCCAnalyses(cgscc);
+  builder.registerFunctionAnalyses(functions);
+  builder.registerLoopAnalyses(loops);
+  builder.crossRegisterProxies(loops, functions, cgscc, modules);
+  llvm::OptimizationLevel levels[] = {
+    llvm::OptimizationLevel::O0,
+    llvm::OptimizationLevel::O1,
+    llvm::OptimizationLevel::O2,
+    llvm::OptimizationLevel::O3
+  };
+  auto pipeline = level == 0 ?
+    builder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0) :
+    builder.buildPerModuleDefaultPipeline(levels[std::min(level, 3u)]);
+  pipeline.run(module, modules);
+}
+
+bool generate(llvm::Module &module,
+              unsigned level,
+              llvm::SmallVectorImpl<char> &object,
+              std::string &error) {
+  auto target = machine(module.getTargetTriple(), level, error);
+  if(target == nullptr) {
+    return false;
+  }
+  optimise(module, *target, level);
+  llvm::legacy::PassManager passes;
+  llvm::raw_svector_ostream out(object);
+  if(target->addPassesToEmitFile(passes, out, nullptr,
+                                 llvm::CGFT_ObjectFile)) {
+    error = "can't emit object files for " + module.getTargetTriple();
+    return false;
+  }
+  passes.run(module);
+  return true;
+}
+
+// A partition arrives as bitcode so it can be loaded into a context of its
+// own, contexts can't be used from two threads at once.
+bool generate(const llvm::SmallVectorImpl<char> &bitcode,
+              const std::string &name,
+              unsigned level,
+              llvm::SmallVectorImpl<char> &object,
+              std::string &error) {
+  llvm::LLVMContext context;
+  auto module = llvm::parseBitcodeFile(
+    llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()),
+                          name),
+    context);
+  if(!module) {
+    error = llvm::toString(module.takeError());
+    return false;
+  }
+  return generate(**module, level, object, error);
+}
+}
+
+void backend::initialise() {
+  std::call_once(initialised, []() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  });
+}
+
+std::unique_ptr<llvm::MemoryBuffer> backend::emit(llvm::Module &module,
+                                                  util::Pool &pool,
+                                                  const Options &options,
+                                                  std::string &error) {
+  initialise();
+  auto triple = llvm::sys::getDefaultTargetTriple();
+  auto target = machine(triple, options.level, error);
+  if(target == nullptr) {
+    return nullptr;
+  }
+  module.setTargetTriple(triple);
+  module.setDataLayout(target->createDataLayout());
+
+  if(options.partitions <= 1) {
+    llvm::SmallVector<char, 0> object;
+    if(!generate(module, options.level, object, error)) {
+      return nullptr;
+    }
+    return llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(object.data(), object.size()));
+  }
+
+  std::vector<llvm::SmallVector<char, 0>> partitions;
+  llvm::SplitModule(module, options.partitions,
+                    [&](std::unique_ptr<llvm::Module> partition) {
+    partitions.emplace_back();
+    llvm::raw_svector_ostream out(partitions.back());
+    llvm::WriteBitcodeToFile(*partition, out);
+  });
+
+  std::vector<std::string> names;
+  std::vector<llvm::SmallVector<char, 0>> objects(partitions.size());
+  std::vector<std::string> errors(partitions.size());
+  std::vector<std::function<void()>> tasks;
+  for(size_t i = 0; i < partitions.size(); i++) {
+    names.push_back(module.getModuleIdentifier() + "." +
+                    std::to_string(i) + ".o");
+    tasks.push_back([&, i]() {
+      generate(partitions[i], names[i], options.level, objects[i], errors[i]);
+    });
+  }
+  pool.run(std::move(tasks));
+
+  std::vector<llvm::NewArchiveMember> members;
+  for(size_t i = 0; i < objects.size(); i++) {
+    if(!errors[i].empty()) {
+      error = errors[i];
+      return nullptr;
+    }
+    llvm::NewArchiveMember member(llvm::MemoryBufferRef(
+      llvm::StringRef(objects[i].data(), objects[i].size()),
+      names[i]));
+    members.push_back(std::move(member));
+  }
+  auto archive = llvm::writeArchiveToBuffer(members, true,
+                                            llvm::object::Archive::K_GNU,
+                                            true, false);
+  if(!archive) {
+    error = llvm::toString(archive.takeError());
+    return nullptr;
+  }
+  return std::move(*archive);
+}
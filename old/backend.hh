@@ -0,0 +1,49 @@
+#ifndef SRC_BACKEND_
+#define SRC_BACKEND_
+
+#include <memory>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "pool.hh"
+
+namespace goat {
+namespace backend {
+
+// Optimises a module and generates native code for the host.
+//
+// With more than one partition the module is split by function with
+// SplitModule, and the partitions are optimised and code generated as
+// separate tasks on the pool, each in its own LLVMContext, then collected
+// into an archive with one object per partition. The partitioning only
+// depends on the module and the partition count, never on the number of
+// threads, so the output is byte for byte the same however many there are.
+//
+// Partitions are optimised separately, so nothing is inlined across them.
+struct Options {
+  Options() :
+    partitions(1),
+    level(2) {}
+  // One partition emits a plain object file.
+  unsigned partitions;
+  // Optimisation level, 0 to 3.
+  unsigned level;
+};
+
+// Sets up the host target. Only the first call does anything, emit calls
+// it too.
+void initialise();
+
+// Returns null and sets `error` if something failed. The module is
+// changed: splitting makes its internal symbols external.
+std::unique_ptr<llvm::MemoryBuffer> emit(llvm::Module &module,
+                                         util::Pool &pool,
+                                         const Options &options,
+                                         std::string &error);
+
+}
+}
+
+#endif
@@ -0,0 +1,303 @@
+// Every front end stage on its own, over generated sources whose size,
+// nesting, label and function counts can be varied one at a time. Each
+// reports its time and allocations per node of the parsed program, so
+// stages and shapes can be compared with each other.
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../driver.hh"
+#include "../eliminator.hh"
+#include "../folder.hh"
+#include "../inferer.hh"
+#include "../inliner.hh"
+#include "../node.hh"
+#include "../renamer.hh"
+#include "../visitor.hh"
+
+using namespace goat;
+using namespace goat::node;
+
+namespace {
+std::atomic<size_t> allocations(0);
+}
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if(auto p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+struct Shape {
+  // Terms in each innermost expression.
+  int size;
+  // Functions nested in each function.
+  int depth;
+  // Arguments to each function, all passed by label.
+  int labels;
+  // Functions declared at the top.
+  int functions;
+};
+
+Shape shape(const benchmark::State &state) {
+  return {int(state.range(0)), int(state.range(1)),
+          int(state.range(2)), int(state.range(3))};
+}
+
+std::string arguments(const Shape &shape, const std::string &value) {
+  std::string out;
+  for(int i = 0; i < shape.labels; i++) {
+    out += (i ? ", a" : "a") + std::to_string(i) + ": " + value;
+  }
+  return out;
+}
+
+std::string body(const Shape &shape, int depth) {
+  std::string out;
+  for(int i = 0; i < shape.size; i++) {
+    out += i ? " + " : "";
+    out += (i % 2) ? std::to_string(i) : "a" + std::to_string(i % shape.labels);
+  }
+  if(depth == 0) {
+    return out;
+  }
+  return "g = program(b) do\n" + body(shape, depth - 1) + " * b\ndone;\n" +
+    "g(b: " + out + ")";
+}
+
+std::string source(const Shape &shape) {
+  std::string out;
+  for(int i = 0; i < shape.functions; i++) {
+    out += "f" + std::to_string(i) + " = program(" + arguments(shape, "0") +
+      ") do\n" + body(shape, shape.depth) + "\ndone;\n";
+  }
+  for(int i = 0; i < shape.functions; i++) {
+    out += (i ? " + f" : "f") + std::to_string(i) + "(" +
+      arguments(shape, std::to_string(i)) + ")";
+  }
+  return out;
+}
+
+std::shared_ptr<Program> parse(const std::string &text) {
+  std::istringstream src(text);
+  std::shared_ptr<Program> program;
+  driver::parse(&src, program);
+  return program;
+}
+
+class Count : public Visitor {
+ public:
+#define COUNT(T)                                  \
+  void visit(const T &node) {                     \
+    count++;                                      \
+    Visitor::visit(node);                         \
+  }
+  COUNT(EmptyExpression)
+  COUNT(Number)
+  COUNT(Identifier)
+  COUNT(String)
+  COUNT(Program)
+  COUNT(Argument)
+  COUNT(Function)
+  COUNT(Closure)
+  COUNT(Label)
+  COUNT(Application)
+  COUNT(Conditional)
+  COUNT(Loop)
+  COUNT(Record)
+  COUNT(Selection)
+  COUNT(Operation)
+  COUNT(Declaration)
+#undef COUNT
+  size_t count = 0;
+};
+
+size_t nodes(const Program &program) {
+  Count count;
+  program.accept(count);
+  return count.count;
+}
+
+// Call once the timed loop is done, with the allocation count from before
+// it.
+void report(benchmark::State &state, size_t nodes, size_t before) {
+  state.counters["nodes"] = nodes;
+  state.counters["time/node"] = benchmark::Counter(
+    nodes,
+    benchmark::Counter::kIsIterationInvariantRate |
+    benchmark::Counter::kInvert);
+  state.counters["allocs/node"] = benchmark::Counter(
+    double(allocations - before) / nodes,
+    benchmark::Counter::kAvgIterations);
+}
+
+// A middling program, then each dimension pushed on its own, `steps` of
+// the way through its values.
+void vary(benchmark::internal::Benchmark *b, size_t steps) {
+  const std::vector<int64_t> middle = {8, 2, 2, 16};
+  const std::vector<std::vector<int64_t>> values = {
+    {2, 32, 128},
+    {0, 8, 32},
+    {1, 8, 32},
+    {1, 64, 256}
+  };
+  b->ArgNames({"size", "depth", "labels", "functions"});
+  b->Args(middle);
+  for(size_t i = 0; i < values.size(); i++) {
+    for(size_t j = 0; j < steps; j++) {
+      auto args = middle;
+      args[i] = values[i][j];
+      b->Args(args);
+    }
+  }
+  b->Unit(benchmark::kMicrosecond);
+}
+
+void shapes(benchmark::internal::Benchmark *b) { vary(b, 3); }
+
+// Unification grows faster than the other stages, so it stops short.
+void smaller(benchmark::internal::Benchmark *b) { vary(b, 2); }
+}
+
+static void BM_Lex(benchmark::State &state) {
+  auto text = source(shape(state));
+  auto program = parse(text);
+  size_t before = allocations;
+  for(auto _ : state) {
+    std::istringstream src(text);
+    size_t tokens = 0;
+    driver::lex(&src, [&](parser::symbol_kind_type, const location &) {
+      tokens++;
+      return true;
+    });
+    benchmark::DoNotOptimize(tokens);
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Lex)->Apply(shapes);
+
+static void BM_Parse(benchmark::State &state) {
+  auto text = source(shape(state));
+  auto program = parse(text);
+  size_t before = allocations;
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(parse(text));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Parse)->Apply(shapes);
+
+static void BM_Clone(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  size_t before = allocations;
+  for(auto _ : state) {
+    TreeCloner cloner;
+    benchmark::DoNotOptimize(cloner.clone(program));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Clone)->Apply(shapes);
+
+static void BM_Renamer(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  size_t before = allocations;
+  for(auto _ : state) {
+    renaming::Renamer renamer;
+    benchmark::DoNotOptimize(renamer.rename(program));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Renamer)->Apply(shapes);
+
+static void BM_Fold(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  auto renamed = renaming::Renamer().rename(program);
+  size_t before = allocations;
+  for(auto _ : state) {
+    folding::Folder folder;
+    benchmark::DoNotOptimize(folder.fold(renamed));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Fold)->Apply(shapes);
+
+static void BM_Inline(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  auto renamed = renaming::Renamer().rename(program);
+  inlining::Inliner::Statistics statistics = {0, 0, 0, 0};
+  size_t before = allocations;
+  for(auto _ : state) {
+    inlining::Inliner inliner;
+    benchmark::DoNotOptimize(inliner.inline_calls(renamed));
+    statistics = inliner.statistics();
+  }
+  state.counters["calls"] = statistics.calls;
+  state.counters["inlined"] = statistics.inlined;
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Inline)->Apply(shapes);
+
+static void BM_Eliminate(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  auto renamed = renaming::Renamer().rename(program);
+  size_t before = allocations;
+  for(auto _ : state) {
+    auto shared = elimination::CommonSubexpressions().eliminate(renamed);
+    benchmark::DoNotOptimize(
+      elimination::DeadDeclarations().eliminate(shared));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Eliminate)->Apply(shapes);
+
+static void BM_Infer(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  auto renamed = renaming::Renamer().rename(program);
+  size_t before = allocations;
+  for(auto _ : state) {
+    inference::Inferer inferer;
+    benchmark::DoNotOptimize(inferer.infer(renamed));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Infer)->Apply(shapes);
+
+static void BM_Unify(benchmark::State &state) {
+  auto program = parse(source(shape(state)));
+  inference::Inferer inferer;
+  inferer.infer(renaming::Renamer().rename(program));
+  size_t before = allocations;
+  for(auto _ : state) {
+    benchmark::DoNotOptimize(
+      inference::Constraint::unify(inferer.constraints()));
+  }
+  state.counters["constraints"] = inferer.constraints().size();
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Unify)->Apply(smaller);
+
+// Everything up to code generation, as the driver does it.
+static void BM_Check(benchmark::State &state) {
+  auto text = source(shape(state));
+  auto program = parse(text);
+  size_t before = allocations;
+  for(auto _ : state) {
+    driver::Report out = {"bench", "", "", 0, 0, false, {}};
+    std::set<inference::Substitution> substitutions;
+    benchmark::DoNotOptimize(driver::check(text, substitutions, out));
+  }
+  report(state, nodes(*program), before);
+}
+BENCHMARK(BM_Check)->Apply(smaller);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,113 @@
+// Virtual against switch based traversal, on a generated program of nested
+// declarations and arithmetic like the ones our scripts are made of.
+#include <benchmark/benchmark.h>
+
+#include "../node.hh"
+#include "../renamer.hh"
+#include "../static_visitor.hh"
+#include "../visitor.hh"
+
+using namespace goat;
+using namespace goat::node;
+
+namespace {
+std::shared_ptr<Node> arithmetic(int depth, int i) {
+  if(depth == 0) {
+    return (i % 2) ? std::shared_ptr<Node>(std::make_shared<Number>(i)) :
+      std::shared_ptr<Node>(std::make_shared<Identifier>("x"));
+  }
+  return std::make_shared<Operation>(arithmetic(depth - 1, i * 2),
+                                     arithmetic(depth - 1, i * 2 + 1),
+                                     static_cast<Ops>(i % 4));
+}
+
+std::shared_ptr<Program> program(int declarations) {
+  std::shared_ptr<Node> expression = std::make_shared<Identifier>("x");
+  for(int i = 0; i < declarations; i++) {
+    expression = std::make_shared<Declaration>(
+      std::make_shared<Identifier>("x"),
+      arithmetic(4, i),
+      expression);
+  }
+  return std::make_shared<Program>(
+    std::make_shared<Declaration>(std::make_shared<Identifier>("x"),
+                                  std::make_shared<Number>(1),
+                                  expression));
+}
+
+class VirtualCount : public Visitor {
+ public:
+  void visit(const Identifier &identifier) { count++; }
+  void visit(const Number &number) { count++; }
+  size_t count = 0;
+};
+
+class StaticCount : public StaticVisitor<StaticCount> {
+ public:
+  using StaticVisitor<StaticCount>::visit;
+  void visit(const Identifier &identifier) { count++; }
+  void visit(const Number &number) { count++; }
+  size_t count = 0;
+};
+
+class Copy : public StaticCloner<Copy> {};
+}
+
+static void BM_VirtualCount(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    VirtualCount count;
+    p->accept(count);
+    benchmark::DoNotOptimize(count.count);
+  }
+}
+BENCHMARK(BM_VirtualCount)->Arg(64)->Arg(1024);
+
+static void BM_StaticCount(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    StaticCount count;
+    count.visit(*p);
+    benchmark::DoNotOptimize(count.count);
+  }
+}
+BENCHMARK(BM_StaticCount)->Arg(64)->Arg(1024);
+
+// TreeCloner is the traversal Inferer does its work on.
+static void BM_VirtualClone(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    TreeCloner cloner;
+    benchmark::DoNotOptimize(cloner.clone(p));
+  }
+}
+BENCHMARK(BM_VirtualClone)->Arg(64)->Arg(1024);
+
+static void BM_StaticClone(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    Copy copy;
+    benchmark::DoNotOptimize(copy.clone(p));
+  }
+}
+BENCHMARK(BM_StaticClone)->Arg(64)->Arg(1024);
+
+static void BM_Renamer(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    renaming::Renamer renamer;
+    benchmark::DoNotOptimize(renamer.rename(p));
+  }
+}
+BENCHMARK(BM_Renamer)->Arg(64)->Arg(1024);
+
+static void BM_StaticRenamer(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    renaming::StaticRenamer renamer;
+    benchmark::DoNotOptimize(renamer.rename(p));
+  }
+}
+BENCHMARK(BM_StaticRenamer)->Arg(64)->Arg(1024);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,74 @@
+// Renaming a wide program sequentially and on a work stealing pool: a
+// balanced tree of conditionals over functions declared at every level.
+#include <benchmark/benchmark.h>
+
+#include "../node.hh"
+#include "../pool.hh"
+#include "../renamer.hh"
+#include "../visitor.hh"
+
+using namespace goat;
+using namespace goat::node;
+
+namespace {
+std::shared_ptr<Node> arithmetic(int depth, int i) {
+  if(depth == 0) {
+    return (i % 2) ? std::shared_ptr<Node>(std::make_shared<Number>(i)) :
+      std::shared_ptr<Node>(std::make_shared<Identifier>("x"));
+  }
+  return std::make_shared<Operation>(arithmetic(depth - 1, i * 2),
+                                     arithmetic(depth - 1, i * 2 + 1),
+                                     static_cast<Ops>(i % 4));
+}
+
+std::shared_ptr<Node> tree(int depth) {
+  if(depth == 0) {
+    return arithmetic(6, depth);
+  }
+  auto args = std::make_shared<ArgumentList>();
+  args->push_back(std::make_shared<Argument>(
+                    std::make_shared<Identifier>("x")));
+  auto function = std::make_shared<Function>(
+    args,
+    std::make_shared<Program>(arithmetic(6, depth)));
+  return std::make_shared<Declaration>(
+    std::make_shared<Identifier>("f"),
+    function,
+    std::make_shared<Conditional>(
+      std::make_shared<Identifier>("x"),
+      std::make_shared<Program>(tree(depth - 1)),
+      std::make_shared<Program>(tree(depth - 1))));
+}
+
+std::shared_ptr<Program> program(int depth) {
+  return std::make_shared<Program>(
+    std::make_shared<Declaration>(std::make_shared<Identifier>("x"),
+                                  std::make_shared<Number>(1),
+                                  tree(depth)));
+}
+}
+
+static void BM_Renamer(benchmark::State &state) {
+  auto p = program(state.range(0));
+  for(auto _ : state) {
+    renaming::Renamer renamer;
+    benchmark::DoNotOptimize(renamer.rename(p));
+  }
+}
+BENCHMARK(BM_Renamer)->Arg(8)->Arg(12)->Unit(benchmark::kMicrosecond);
+
+static void BM_ParallelRenamer(benchmark::State &state) {
+  auto p = program(state.range(0));
+  util::Pool pool(state.range(1));
+  for(auto _ : state) {
+    renaming::Renamer renamer;
+    renamer.parallel(&pool);
+    benchmark::DoNotOptimize(renamer.rename(p));
+  }
+}
+BENCHMARK(BM_ParallelRenamer)
+  ->ArgsProduct({{8, 12}, {1, 2, 4, 8}})
+  ->Unit(benchmark::kMicrosecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
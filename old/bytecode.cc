@@ -0,0 +1,252 @@
+#include <limits>
+
+#include "bytecode.hh"
+
+using namespace goat;
+using namespace node;
+using namespace bytecode;
+
+std::optional<Module> Assembler::assemble(const Program &program) {
+  program.accept(tails_);
+  module_.functions.push_back({"main", 0, 0, {}});
+  module_.main = 0;
+  index_ = 0;
+  function_ = &module_.functions[0];
+  program.accept(*this);
+  if(!supported_) {
+    return std::nullopt;
+  }
+  emit(Return, current_);
+  return module_;
+}
+
+uint16_t Assembler::reg() {
+  if(function_->registers == std::numeric_limits<uint16_t>::max()) {
+    unsupported();
+    return 0;
+  }
+  return function_->registers++;
+}
+
+uint16_t Assembler::constant(double value) {
+  if(module_.constants.size() > std::numeric_limits<uint16_t>::max()) {
+    unsupported();
+    return 0;
+  }
+  module_.constants.push_back(value);
+  return module_.constants.size() - 1;
+}
+
+size_t Assembler::emit(Opcode op, uint16_t a, uint16_t b, uint16_t c) {
+  // Jumps hold their target in 16 bits.
+  if(function_->code.size() > std::numeric_limits<uint16_t>::max()) {
+    unsupported();
+  }
+  function_->code.push_back({op, a, b, c});
+  return function_->code.size() - 1;
+}
+
+void Assembler::unsupported() {
+  supported_ = false;
+}
+
+void Assembler::visit(const EmptyExpression &empty) {
+  current_ = reg();
+  emit(Constant, current_, constant(0));
+}
+
+void Assembler::visit(const Number &number) {
+  current_ = reg();
+  emit(Constant, current_, constant(number.value()));
+}
+
+void Assembler::visit(const Identifier &identifier) {
+  auto local = scope_.find(identifier.internal_value());
+  if(local == scope_.end()) {
+    // A function used as a value, or a variable from an enclosing function.
+    unsupported();
+    return;
+  }
+  current_ = local->second;
+}
+
+void Assembler::visit(const String &string) {
+  unsupported();
+}
+
+void Assembler::visit(const Program &program) {
+  program.expression()->accept(*this);
+}
+
+void Assembler::visit(const Argument &argument) {
+  unsupported();
+}
+
+// Only functions bound by a declaration get here, see visit(Declaration).
+void Assembler::visit(const node::Function &function) {
+  unsupported();
+}
+
+void Assembler::visit(const Closure &closure) {
+  unsupported();
+}
+
+void Assembler::visit(const Label &label) {
+  label.expression()->accept(*this);
+}
+
+void Assembler::visit(const Application &application) {
+  auto callee = functions_.find(application.identifier()->internal_value());
+  if(callee == functions_.end()) {
+    unsupported();
+    return;
+  }
+
+  // Evaluate everything before claiming the window, so nothing else lands
+  // in the middle of it.
+  auto &labels = *application.labels();
+  std::vector<uint16_t> args;
+  for(auto &p : callee->second.params) {
+    auto label = labels.find(p);
+    if(label == labels.end()) {
+      unsupported();
+      return;
+    }
+    label->second->accept(*this);
+    args.push_back(current_);
+  }
+  uint16_t base = function_->registers;
+  for(auto a : args) {
+    emit(Move, reg(), a);
+  }
+  if(tails_.tail(application)) {
+    emit(TailCall, 0, callee->second.index, base);
+    current_ = base;
+    return;
+  }
+  current_ = reg();
+  emit(Call, current_, callee->second.index, base);
+}
+
+void Assembler::visit(const Conditional &conditional) {
+  conditional.expression()->accept(*this);
+  auto condition = current_;
+  auto result = reg();
+  auto skip = emit(JumpIfZero, condition);
+  conditional.true_block()->accept(*this);
+  emit(Move, result, current_);
+  auto end = emit(Jump, 0);
+  function_->code[skip].b = function_->code.size();
+  conditional.false_block()->accept(*this);
+  emit(Move, result, current_);
+  function_->code[end].b = function_->code.size();
+  current_ = result;
+}
+
+// The result is the last iteration's, or zero when there were none.
+void Assembler::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = reg();
+  emit(Truncate, count, current_);
+
+  uint16_t start = reg();
+  if(loop.counter() != nullptr &&
+     *loop.counter()->expression() != EmptyExpression()) {
+    loop.counter()->expression()->accept(*this);
+    emit(Move, start, current_);
+  } else {
+    emit(Constant, start, constant(0));
+  }
+
+  auto index = reg();
+  auto one = reg();
+  auto result = reg();
+  auto test = reg();
+  emit(Constant, index, constant(0));
+  emit(Constant, one, constant(1));
+  emit(Constant, result, constant(0));
+  auto head = function_->code.size();
+  emit(Less, test, index, count);
+  auto exit = emit(JumpIfZero, test);
+  if(loop.counter() != nullptr) {
+    auto counter = reg();
+    emit(Add, counter, start, index);
+    scope_[loop.counter()->identifier()->internal_value()] = counter;
+  }
+  loop.program()->accept(*this);
+  emit(Move, result, current_);
+  emit(Add, index, index, one);
+  emit(Jump, 0, head);
+  function_->code[exit].b = function_->code.size();
+  current_ = result;
+}
+
+void Assembler::visit(const Record &record) {
+  unsupported();
+}
+
+void Assembler::visit(const Selection &selection) {
+  unsupported();
+}
+
+void Assembler::visit(const Operation &operation) {
+  operation.left()->accept(*this);
+  auto left = current_;
+  operation.right()->accept(*this);
+  auto right = current_;
+  current_ = reg();
+  switch(operation.operation()) {
+  case Addition:
+    emit(Add, current_, left, right);
+    break;
+  case Subtraction:
+    emit(Subtract, current_, left, right);
+    break;
+  case Division:
+    emit(Divide, current_, left, right);
+    break;
+  case Multiplication:
+    emit(Multiply, current_, left, right);
+    break;
+  }
+}
+
+void Assembler::visit(const Declaration &declaration) {
+  auto name = declaration.identifier()->internal_value();
+  auto function = std::dynamic_pointer_cast<node::Function>(
+    declaration.value());
+  if(!function) {
+    declaration.value()->accept(*this);
+    scope_[name] = current_;
+    declaration.expression()->accept(*this);
+    return;
+  }
+
+  // Registered first so the body can call itself.
+  auto index = static_cast<uint16_t>(module_.functions.size());
+  Callee callee = {index, {}};
+  for(auto a : *function->arguments()) {
+    callee.params.push_back(a->identifier()->value());
+  }
+  functions_[name] = callee;
+  module_.functions.push_back({name,
+                               static_cast<uint16_t>(callee.params.size()),
+                               0,
+                               {}});
+
+  auto outer = index_;
+  auto scope = scope_;
+  index_ = index;
+  function_ = &module_.functions[index];
+  scope_.clear();
+  for(auto a : *function->arguments()) {
+    scope_[a->identifier()->internal_value()] = reg();
+  }
+  function->program()->accept(*this);
+  emit(Return, current_);
+  index_ = outer;
+  function_ = &module_.functions[outer];
+  scope_ = scope;
+
+  declaration.expression()->accept(*this);
+}
@@ -0,0 +1,127 @@
+#ifndef SRC_BYTECODE_
+#define SRC_BYTECODE_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "node.hh"
+#include "tailcalls.hh"
+#include "visitor.hh"
+
+namespace goat {
+namespace bytecode {
+
+// A register machine over unboxed doubles, for programs too short to be
+// worth handing to LLVM. Every function has its own window of registers,
+// with its parameters in the first few; a call puts the arguments in
+// consecutive registers of the caller and the callee's window starts there.
+enum Opcode : uint8_t {
+  // a = constants[b]
+  Constant,
+  // a = b
+  Move,
+  // a = b op c
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+  // a = b < c ? 1 : 0
+  Less,
+  // a = trunc(b)
+  Truncate,
+  // goto b
+  Jump,
+  // if a is zero or NaN goto b
+  JumpIfZero,
+  // a = functions[b](registers from c on)
+  Call,
+  // The arguments are in registers from c on, replace the current call
+  // with one to functions[b].
+  TailCall,
+  // return a
+  Return,
+  Opcodes
+};
+
+struct Instruction {
+  Opcode op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+};
+
+struct Function {
+  std::string name;
+  uint16_t params;
+  uint16_t registers;
+  std::vector<Instruction> code;
+};
+
+struct Module {
+  std::vector<Function> functions;
+  std::vector<double> constants;
+  // The function holding the top level of the program.
+  uint16_t main;
+};
+
+// Translates a typed program, before lifting, into bytecode. Covers what
+// numeric scripts use: numbers, arithmetic, conditionals, loops and direct
+// calls to named functions that only use their own parameters and locals.
+// Anything else, strings, records or functions as values, gives nothing
+// back and the program goes to the LLVM backend instead.
+class Assembler : public node::Visitor {
+ public:
+  Assembler() :
+    module_(),
+    tails_(),
+    functions_(),
+    scope_(),
+    function_(nullptr),
+    index_(0),
+    current_(0),
+    supported_(true) {}
+  void visit(const node::EmptyExpression &empty);
+  void visit(const node::Number &number);
+  void visit(const node::Identifier &identifier);
+  void visit(const node::String &string);
+  void visit(const node::Program &program);
+  void visit(const node::Argument &argument);
+  void visit(const node::Function &function);
+  void visit(const node::Closure &closure);
+  void visit(const node::Label &label);
+  void visit(const node::Application &application);
+  void visit(const node::Conditional &conditional);
+  void visit(const node::Loop &loop);
+  void visit(const node::Record &record);
+  void visit(const node::Selection &selection);
+  void visit(const node::Operation &operation);
+  void visit(const node::Declaration &declaration);
+  std::optional<Module> assemble(const node::Program &program);
+ private:
+  struct Callee {
+    uint16_t index;
+    std::vector<std::string> params;
+  };
+  uint16_t reg();
+  uint16_t constant(double value);
+  size_t emit(Opcode op, uint16_t a, uint16_t b = 0, uint16_t c = 0);
+  void unsupported();
+  Module module_;
+  compiling::TailCalls tails_;
+  std::map<std::string, Callee> functions_;
+  std::map<std::string, uint16_t> scope_;
+  // Where the function being assembled is, by index since functions_ grows.
+  Function *function_;
+  uint16_t index_;
+  uint16_t current_;
+  bool supported_;
+};
+
+}
+}
+
+#endif
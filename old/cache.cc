@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
+
+#include "cache.hh"
+
+using namespace goat::caching;
+namespace fs = std::filesystem;
+
+namespace {
+const char magic[] = "goat-cache 1\n";
+const char temporary[] = ".tmp.";
+std::atomic<uint64_t> writes(0);
+
+// What built the compiler, so rebuilding it invalidates everything it
+// cached: the version the build names, or else a hash of the running
+// executable. One that can't be read gets a version no other process
+// shares, which only costs the reuse.
+const std::string &version() {
+  static const std::string version = []() -> std::string {
+#ifdef GOAT_VERSION
+    return GOAT_VERSION;
+#else
+    std::ifstream file("/proc/self/exe", std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    if(!file || contents.str().empty()) {
+      return "process " + std::to_string(getpid()) + " " +
+        std::to_string(std::chrono::system_clock::now()
+                         .time_since_epoch().count());
+    }
+    llvm::SHA1 sha;
+    sha.update(contents.str());
+    return llvm::toHex(sha.final(), true);
+#endif
+  }();
+  return version;
+}
+}
+
+std::string Cache::key(const std::string &source, const std::string &flags) {
+  llvm::SHA1 sha;
+  // Each part ends in a nul so no two splits of the same bytes collide.
+  for(auto part : {version(), flags, source}) {
+    sha.update(llvm::StringRef(part.c_str(), part.size() + 1));
+  }
+  return llvm::toHex(sha.final(), true);
+}
+
+std::optional<Entry> Cache::find(const std::string &key) const {
+  auto path = fs::path(directory_) / key;
+  std::ifstream file(path, std::ios::binary);
+  if(!file) {
+    return std::nullopt;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  auto data = contents.str();
+  auto header = sizeof(magic) - 1;
+  auto newline = data.find('\n', header);
+  if(data.compare(0, header, magic) != 0 || newline == std::string::npos) {
+    return std::nullopt;
+  }
+  std::error_code error;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+  return Entry{data.substr(newline + 1),
+               data.substr(header, newline - header)};
+}
+
+bool Cache::store(const std::string &key, const Entry &entry) const {
+  std::error_code error;
+  fs::create_directories(directory_, error);
+  auto path = fs::path(directory_) / key;
+  auto scratch = path;
+  scratch += temporary + std::to_string(getpid()) + "." +
+    std::to_string(writes++);
+  {
+    std::ofstream file(scratch, std::ios::binary);
+    file << magic << entry.type << '\n' << entry.bitcode;
+    if(!file.flush()) {
+      fs::remove(scratch, error);
+      return false;
+    }
+  }
+  fs::rename(scratch, path, error);
+  if(error) {
+    fs::remove(scratch, error);
+    return false;
+  }
+  evict();
+  return true;
+}
+
+// Other processes may be evicting at the same time, so files vanishing
+// under us is fine.
+void Cache::evict() const {
+  struct File {
+    fs::path path;
+    fs::file_time_type used;
+    uint64_t size;
+  };
+  std::vector<File> files;
+  uint64_t total = 0;
+  std::error_code error;
+  for(fs::directory_iterator i(directory_, error), end; !error && i != end;
+      i.increment(error)) {
+    if(i->path().filename().string().find(temporary) != std::string::npos) {
+      continue;
+    }
+    std::error_code missing;
+    auto size = i->file_size(missing);
+    auto used = i->last_write_time(missing);
+    if(missing) continue;
+    files.push_back({i->path(), used, size});
+    total += size;
+  }
+  if(total <= limit_) {
+    return;
+  }
+  std::sort(files.begin(), files.end(), [](auto &a, auto &b) {
+    return a.used < b.used;
+  });
+  for(auto &f : files) {
+    if(total <= limit_) break;
+    fs::remove(f.path, error);
+    total -= f.size;
+  }
+}
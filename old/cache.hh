@@ -0,0 +1,46 @@
+#ifndef SRC_CACHE_
+#define SRC_CACHE_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace goat {
+namespace caching {
+
+// What compiling a file leaves behind.
+struct Entry {
+  // The module, before its entry point is renamed for linking.
+  std::string bitcode;
+  // The solved type of the program.
+  std::string type;
+};
+
+// Compiled files on disk, named by a hash of everything that went into
+// compiling them, so an entry never goes stale and is never invalidated.
+//
+// Entries are written to a temporary file and renamed into place, so
+// processes sharing the directory only ever see whole entries. Reading an
+// entry marks it as recently used and once the directory goes over its size
+// limit the least recently used entries are removed.
+class Cache {
+ public:
+  Cache(std::string directory, uint64_t limit) :
+    directory_(directory),
+    limit_(limit) {}
+  // The key of a source compiled with the given flags by this compiler.
+  static std::string key(const std::string &source, const std::string &flags);
+  std::optional<Entry> find(const std::string &key) const;
+  // Whether the entry could be written, a cache that can't be written to
+  // just makes for slower compiles.
+  bool store(const std::string &key, const Entry &entry) const;
+ private:
+  void evict() const;
+  std::string directory_;
+  uint64_t limit_;
+};
+
+}
+}
+
+#endif
@@ -1,20 +1,560 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include "compiler.hh"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include "runtime.hh"
 
 using namespace goat;
 using namespace node;
 using namespace compiling;
 using namespace inference;
 
+namespace {
+// What evaluating an expression costs, or nothing if it may have effects
+// beyond producing its value, like calling or allocating. Joining strings
+// allocates, so it's only numeric operations that count.
+class Cost : public Visitor {
+ public:
+  explicit Cost(std::function<Type(const Type &)> resolve) :
+    cost_(0),
+    speculatable_(true),
+    resolve_(resolve) {}
+  void visit(const Program &program) { Visitor::visit(program); }
+  void visit(const EmptyExpression &empty) {}
+  void visit(const Number &number) {}
+  void visit(const String &string) {}
+  void visit(const Identifier &identifier) { cost_++; }
+  void visit(const Selection &selection) { cost_++; Visitor::visit(selection); }
+  void visit(const Operation &operation) {
+    if(std::holds_alternative<StringType>(resolve_(operation.type()))) {
+      speculatable_ = false;
+      return;
+    }
+    cost_ += operation.operation() == Division ? 4 : 1;
+    Visitor::visit(operation);
+  }
+  void visit(const Argument &argument) { speculatable_ = false; }
+  void visit(const Function &function) { speculatable_ = false; }
+  void visit(const Closure &closure) { speculatable_ = false; }
+  void visit(const Label &label) { speculatable_ = false; }
+  void visit(const Application &application) { speculatable_ = false; }
+  void visit(const Conditional &conditional) { speculatable_ = false; }
+  void visit(const Loop &loop) { speculatable_ = false; }
+  void visit(const Record &record) { speculatable_ = false; }
+  void visit(const Declaration &declaration) { speculatable_ = false; }
+  std::optional<unsigned> cost() const {
+    return speculatable_ ? std::optional<unsigned>(cost_) : std::nullopt;
+  }
+ private:
+  unsigned cost_;
+  bool speculatable_;
+  std::function<Type(const Type &)> resolve_;
+};
+
+// Whether evaluating an expression may allocate: joining strings, building
+// closures or calling something that might.
+class Allocates : public Visitor {
+ public:
+  explicit Allocates(std::function<Type(const Type &)> resolve) :
+    allocates_(false),
+    resolve_(resolve) {}
+  void visit(const Operation &operation) {
+    if(std::holds_alternative<StringType>(resolve_(operation.type()))) {
+      allocates_ = true;
+    }
+    Visitor::visit(operation);
+  }
+  void visit(const Closure &closure) { allocates_ = true; }
+  void visit(const Application &application) { allocates_ = true; }
+  bool allocates() const { return allocates_; }
+ private:
+  bool allocates_;
+  std::function<Type(const Type &)> resolve_;
+};
+}
+
+// Whether a value could hold a pointer, say to an environment.
+static bool pointer(llvm::Type *type) {
+  if(type->isPointerTy()) {
+    return true;
+  }
+  for(auto element : type->subtypes()) {
+    if(pointer(element)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static llvm::AllocaInst *CreateAlloca(llvm::Function *function,
-                                      llvm::LLVMContext &context,
+                                      llvm::Type *type,
                                       const std::string &VarName) {
   llvm::IRBuilder<> TmpB(&function->getEntryBlock(),
                    function->getEntryBlock().begin());
-  return TmpB.CreateAlloca(llvm::Type::getDoubleTy(context), nullptr,
-                           VarName.c_str());
+  return TmpB.CreateAlloca(type, nullptr, VarName.c_str());
+}
+
+// Matches a generic type against a concrete one, recording what each type
+// variable stands for in this instantiation.
+static void instantiate(const Type &generic,
+                        const Type &concrete,
+                        std::map<std::string, Type> &instance) {
+  if(std::holds_alternative<TypeVariable>(generic)) {
+    instance.insert({std::get<TypeVariable>(generic).id(), concrete});
+    return;
+  }
+  if(std::holds_alternative<FunctionType>(generic) &&
+     std::holds_alternative<FunctionType>(concrete)) {
+    auto &g = std::get<FunctionType>(generic).types();
+    auto &c = std::get<FunctionType>(concrete).types();
+    if(g.size() != c.size()) return;
+    for(size_t i = 0; i < g.size(); i++) {
+      instantiate(g[i], c[i], instance);
+    }
+  }
+  // Fields pair up as in unification, and whatever the concrete row has
+  // left over is what the generic row's tail stands for.
+  if(std::holds_alternative<RecordType>(generic) &&
+     std::holds_alternative<RecordType>(concrete)) {
+    auto &g = std::get<RecordType>(generic);
+    auto &c = std::get<RecordType>(concrete);
+    std::vector<std::string> labels;
+    std::vector<Type> types;
+    size_t i = 0;
+    for(size_t j = 0; j < c.labels().size(); j++) {
+      while(i < g.labels().size() && g.labels()[i] < c.labels()[j]) i++;
+      if(i < g.labels().size() && g.labels()[i] == c.labels()[j]) {
+        instantiate(g.types()[i++], c.types()[j], instance);
+      } else {
+        labels.push_back(c.labels()[j]);
+        types.push_back(c.types()[j]);
+      }
+    }
+    if(g.tail()) {
+      instance.insert({g.tail()->id(), RecordType(labels, types)});
+    }
+  }
+}
+
+Compiler::Compiler(std::set<Substitution> substitutions, Options options) :
+  options_(options),
+  ranges_(),
+  escapes_(),
+  tails_(),
+  frame_(),
+  bindings_(),
+  instantiations_(),
+  templates_(),
+  known_(),
+  strings_(),
+  specialisations_(),
+  namer_(),
+  context_(),
+  builder_(context_),
+  module_(std::make_unique<llvm::Module>("Goat", context_)),
+  string_type_(llvm::StructType::create(
+    context_,
+    {llvm::Type::getInt8PtrTy(context_), llvm::Type::getInt64Ty(context_)},
+    "goat.string")),
+  closure_type_(llvm::StructType::create(
+    context_,
+    {llvm::Type::getInt8PtrTy(context_), llvm::Type::getInt8PtrTy(context_)},
+    "goat.closure")),
+  scope_(),
+  current_(),
+  error_() {
+  for(auto s : substitutions) {
+    if(std::holds_alternative<TypeVariable>(s.left())) {
+      bindings_[std::get<TypeVariable>(s.left()).id()] = s.right();
+    }
+  }
+}
+
+Type Compiler::resolve(const Type &type) const {
+  if(std::holds_alternative<TypeVariable>(type)) {
+    auto id = std::get<TypeVariable>(type).id();
+    auto bound = bindings_.find(id);
+    if(bound != bindings_.end()) {
+      return resolve(bound->second);
+    }
+    if(!instantiations_.empty()) {
+      auto instance = instantiations_.back().find(id);
+      if(instance != instantiations_.back().end()) {
+        return resolve(instance->second);
+      }
+    }
+    return type;
+  }
+  if(std::holds_alternative<FunctionType>(type)) {
+    std::vector<Type> types;
+    for(auto t : std::get<FunctionType>(type).types()) {
+      types.push_back(resolve(t));
+    }
+    return FunctionType(types);
+  }
+  if(std::holds_alternative<RecordType>(type)) {
+    auto &record = std::get<RecordType>(type);
+    std::vector<Type> types;
+    for(auto t : record.types()) {
+      types.push_back(resolve(t));
+    }
+    RecordType row(record.labels(), types);
+    if(!record.tail()) {
+      return row;
+    }
+    // A tail nothing ever fills in is an empty row.
+    auto rest = resolve(*record.tail());
+    if(std::holds_alternative<RecordType>(rest)) {
+      return row.extend(std::get<RecordType>(rest));
+    }
+    return row;
+  }
+  return type;
+}
+
+llvm::Type *Compiler::lower(const Type &type) {
+  return std::visit([this](auto&& arg) -> llvm::Type * {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (std::is_same_v<T, NumberType>) {
+        return llvm::Type::getDoubleTy(context_);
+      } else if constexpr (std::is_same_v<T, BoolType>) {
+        return llvm::Type::getInt1Ty(context_);
+      } else if constexpr (std::is_same_v<T, StringType>) {
+        return string_type_;
+      } else if constexpr (std::is_same_v<T, FunctionType>) {
+        return closure_type_;
+      } else if constexpr (std::is_same_v<T, RecordType>) {
+        // Fields are laid out in label order, shadowed ones included, so a
+        // selection is a constant index into the struct.
+        std::vector<llvm::Type *> fields;
+        for(auto &t : arg.types()) {
+          fields.push_back(lower(t));
+        }
+        return llvm::StructType::get(context_, fields);
+      } else {
+        // Nothing ever looks inside a value of unknown type, so any
+        // representation will do.
+        return llvm::Type::getInt8PtrTy(context_);
+      }
+    }, resolve(type));
+}
+
+llvm::FunctionType *Compiler::signature(const FunctionType &type) {
+  std::vector<llvm::Type *> params = {llvm::Type::getInt8PtrTy(context_)};
+  auto &types = type.types();
+  for(auto t = types.begin(); t != types.end() - 1; t++) {
+    params.push_back(lower(*t));
+  }
+  return llvm::FunctionType::get(lower(type.ret()), params, false);
+}
+
+// Whether a value of this type can hold no pointers.
+bool Compiler::scalar(const Type &type) const {
+  auto resolved = resolve(type);
+  if(std::holds_alternative<NumberType>(resolved) ||
+     std::holds_alternative<BoolType>(resolved)) {
+    return true;
+  }
+  if(std::holds_alternative<RecordType>(resolved)) {
+    for(auto &t : std::get<RecordType>(resolved).types()) {
+      if(!scalar(t)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+// Nothing a function allocates can outlive it if its result has nowhere to
+// point, so all of that goes in a region. Called from the entry block, so
+// self tail calls stay in the same region.
+void Compiler::enter(const Type &result) {
+  if(!scalar(result)) {
+    return;
+  }
+  frame_.region = region("goat_region_enter");
+}
+
+// Calls one of the runtime's region functions, all of which take the mark
+// but goat_region_enter, which returns it.
+llvm::Value *Compiler::region(const char *name, llvm::Value *mark) {
+  auto i8p = llvm::Type::getInt8PtrTy(context_);
+  if(!mark) {
+    auto enter = module_->getOrInsertFunction(
+      name,
+      llvm::FunctionType::get(i8p, false)
+    );
+    return builder_.CreateCall(enter, {}, "region");
+  }
+  auto callee = module_->getOrInsertFunction(
+    name,
+    llvm::FunctionType::get(llvm::Type::getVoidTy(context_), {i8p}, false)
+  );
+  return builder_.CreateCall(callee, {mark});
+}
+
+void Compiler::ret(llvm::Value *value) {
+  if(frame_.region) {
+    region("goat_region_leave", frame_.region);
+  }
+  builder_.CreateRet(value);
+}
+
+llvm::StructType *Compiler::environment(const IdentifierList &captures) {
+  std::vector<llvm::Type *> fields;
+  for(auto c : captures) {
+    fields.push_back(lower(c->type()));
+  }
+  return llvm::StructType::get(context_, fields);
+}
+
+llvm::Value *Compiler::closure(llvm::Function *function,
+                               llvm::Value *environment) {
+  auto i8p = llvm::Type::getInt8PtrTy(context_);
+  llvm::Value *value = llvm::UndefValue::get(closure_type_);
+  value = builder_.CreateInsertValue(value,
+                                     builder_.CreateBitCast(function, i8p),
+                                     0);
+  return builder_.CreateInsertValue(value, environment, 1);
+}
+
+llvm::AllocaInst *Compiler::bind(const std::string &name, llvm::Value *value) {
+  llvm::Function *fn = builder_.GetInsertBlock()->getParent();
+  llvm::AllocaInst *alloca = CreateAlloca(fn, value->getType(), name);
+  builder_.CreateStore(value, alloca);
+  scope_[name] = alloca;
+  return alloca;
+}
+
+void Compiler::call(llvm::FunctionType *type,
+                    llvm::Value *callee,
+                    const std::vector<llvm::Value *> &args,
+                    bool tail) {
+  auto call = builder_.CreateCall(type, callee, args);
+  current_ = call;
+  // Arguments may point into the region, which has to outlive the call.
+  if(!tail || !frame_.function || frame_.region) {
+    return;
+  }
+  // musttail needs matching prototypes and a return straight after.
+  if(frame_.function->getFunctionType() != type) {
+    call->setTailCallKind(llvm::CallInst::TCK_Tail);
+    return;
+  }
+  call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  builder_.CreateRet(call);
+  unreachable();
+}
+
+// Carries on after a terminator in a block nothing branches to, with a
+// placeholder value for whatever expected one.
+void Compiler::unreachable() {
+  builder_.SetInsertPoint(
+    llvm::BasicBlock::Create(context_, "after.tail", frame_.function)
+  );
+  current_ = llvm::UndefValue::get(frame_.function->getReturnType());
+}
+
+// Strings go through memory so the runtime can read small strings in place.
+void Compiler::concat(const Operation &operation) {
+  operation.left()->accept(*this);
+  llvm::Value *left = current_;
+  operation.right()->accept(*this);
+  llvm::Value *right = current_;
+  if(!left || !right) {
+    current_ = nullptr;
+    return;
+  }
+
+  auto fn = builder_.GetInsertBlock()->getParent();
+  auto out = CreateAlloca(fn, string_type_, "concat");
+  auto lhs = CreateAlloca(fn, string_type_, "lhs");
+  auto rhs = CreateAlloca(fn, string_type_, "rhs");
+  builder_.CreateStore(left, lhs);
+  builder_.CreateStore(right, rhs);
+  auto ptr = string_type_->getPointerTo();
+  auto runtime = module_->getOrInsertFunction(
+    "goat_string_concat",
+    llvm::FunctionType::get(llvm::Type::getVoidTy(context_),
+                            {ptr, ptr, ptr},
+                            false)
+  );
+  builder_.CreateCall(runtime, {out, lhs, rhs});
+  current_ = builder_.CreateLoad(string_type_, out);
+}
+
+// Emits an expression that IntegerRanges proved integral as an i64.
+llvm::Value *Compiler::integer(const Node &node) {
+  auto i64 = llvm::Type::getInt64Ty(context_);
+  auto number = dynamic_cast<const Number *>(&node);
+  // Converting a double past the range of an i64 is undefined, so counts
+  // past 2^53 are as good as endless and NaN is none.
+  if(number) {
+    const double exact = 9007199254740992.0;
+    auto value = std::isnan(number->value()) ?
+      0 : std::clamp(number->value(), -exact, exact);
+    return llvm::ConstantInt::get(i64, int64_t(value), true);
+  }
+
+  auto operation = dynamic_cast<const Operation *>(&node);
+  if(operation && ranges_.integral(*operation)) {
+    llvm::Value *left = integer(*operation->left());
+    llvm::Value *right = integer(*operation->right());
+    if(!left || !right) {
+      return nullptr;
+    }
+    // The range analysis rules out overflow, hence nsw.
+    switch(operation->operation()) {
+    case Addition:
+      return builder_.CreateNSWAdd(left, right);
+    case Subtraction:
+      return builder_.CreateNSWSub(left, right);
+    case Multiplication:
+      return builder_.CreateNSWMul(left, right);
+    case Division:
+      break;
+    }
+  }
+
+  auto identifier = dynamic_cast<const Identifier *>(&node);
+  if(identifier) {
+    auto v = scope_.find(identifier->internal_value());
+    if(v != scope_.end() && v->second->getAllocatedType() == i64) {
+      return builder_.CreateLoad(i64, v->second, identifier->internal_value());
+    }
+  }
+
+  node.accept(*this);
+  if(!current_) {
+    return nullptr;
+  }
+  // The same goes for ones only known when it runs, which saturate.
+  return builder_.CreateIntrinsic(llvm::Intrinsic::fptosi_sat,
+                                  {i64, current_->getType()},
+                                  {current_});
+}
+
+llvm::Function *Compiler::specialise(const std::string &name,
+                                     const Function &function,
+                                     const Type &type) {
+  auto concrete = resolve(type);
+  // Captured variables can have types only the enclosing instance knows,
+  // so they tell instances apart as well.
+  std::vector<Type> captured;
+  for(auto c : *function.captures()) {
+    captured.push_back(resolve(c->type()));
+  }
+  auto key = std::make_tuple(name, concrete, captured);
+  auto found = specialisations_.find(key);
+  if(found != specialisations_.end()) {
+    return found->second;
+  }
+
+  Instantiation instance;
+  instantiate(resolve(function.type()), concrete, instance);
+  if(!instantiations_.empty()) {
+    instance.insert(instantiations_.back().begin(),
+                    instantiations_.back().end());
+  }
+  instantiations_.push_back(instance);
+
+  auto fn = llvm::Function::Create(
+    signature(std::get<FunctionType>(concrete)),
+    llvm::Function::InternalLinkage,
+    name,
+    module_.get()
+  );
+  // Registered before the body is compiled so recursive calls find it.
+  specialisations_[key] = fn;
+
+  auto block = builder_.GetInsertBlock();
+  auto scope = scope_;
+  auto frame = frame_;
+  scope_.clear();
+  frame_ = {name, fn, nullptr, {}, nullptr, false};
+  builder_.SetInsertPoint(llvm::BasicBlock::Create(context_, "entry", fn));
+
+  auto param = fn->arg_begin();
+  llvm::Value *env = &*param++;
+  env->setName("env");
+  auto &captures = *function.captures();
+  if(!captures.empty()) {
+    auto type = environment(captures);
+    auto record = builder_.CreateBitCast(env, type->getPointerTo());
+    for(unsigned i = 0; i < captures.size(); i++) {
+      auto capture = captures[i]->internal_value();
+      auto field = builder_.CreateStructGEP(type, record, i);
+      bind(capture, builder_.CreateLoad(type->getElementType(i),
+                                        field,
+                                        capture));
+    }
+    // Recursive calls go straight back here with the same environment.
+    bind(name, closure(fn, env));
+  }
+  for(auto a : *function.arguments()) {
+    auto name = a->identifier()->internal_value();
+    param->setName(name);
+    frame_.params.push_back(bind(name, &*param++));
+  }
+  enter(std::get<FunctionType>(concrete).ret());
+  // Self tail calls jump back here with new arguments.
+  frame_.body = llvm::BasicBlock::Create(context_, "body", fn);
+  builder_.CreateBr(frame_.body);
+  builder_.SetInsertPoint(frame_.body);
+
+  function.program()->accept(*this);
+  if(current_) {
+    ret(current_);
+  } else {
+    perror("Compiler bug, couldn't compile a function body.");
+  }
+
+  scope_ = scope;
+  frame_ = frame;
+  if(block) {
+    builder_.SetInsertPoint(block);
+  }
+  instantiations_.pop_back();
+  return fn;
+}
+
+llvm::Module *Compiler::compile(std::shared_ptr<Program> program) {
+  auto type = llvm::FunctionType::get(lower(program->type()), false);
+  auto fn = llvm::Function::Create(type,
+                                   llvm::Function::ExternalLinkage,
+                                   "goat_main",
+                                   module_.get());
+  builder_.SetInsertPoint(llvm::BasicBlock::Create(context_, "entry", fn));
+  frame_ = {"goat_main", fn, nullptr, {}, nullptr, false};
+  enter(program->type());
+  program->accept(ranges_);
+  escapes_.analyse(*program);
+  program->accept(tails_);
+  program->accept(*this);
+  if(!current_) {
+    return nullptr;
+  }
+  ret(current_);
+  // A malformed module would only fail later in the backend or the cache,
+  // far from what caused it.
+  llvm::raw_string_ostream out(error_);
+  if(llvm::verifyModule(*module_, &out)) {
+    out.flush();
+    return nullptr;
+  }
+  return module_.get();
+}
+
+void Compiler::visit(const EmptyExpression &empty) {
+  current_ = llvm::Constant::getNullValue(lower(empty.type()));
 }
 
 void Compiler::visit(const Number &number) {
@@ -22,63 +562,493 @@ void Compiler::visit(const Number &number) {
 }
 
 void Compiler::visit(const Identifier &identifier) {
-  llvm::Value *v = scope_[identifier.value()];
-  if(!v) {
-    current_ = nullptr;
+  auto name = identifier.internal_value();
+  auto v = scope_.find(name);
+  if(v != scope_.end()) {
+    auto type = v->second->getAllocatedType();
+    current_ = builder_.CreateLoad(type, v->second, name);
+    // Integral variables live in i64 slots.
+    if(type->isIntegerTy(64)) {
+      current_ = builder_.CreateSIToFP(current_,
+                                       llvm::Type::getDoubleTy(context_));
+    }
+    return;
+  }
+  // A known function used as a value, hand out the instance for this type.
+  auto t = templates_.find(name);
+  if(t != templates_.end()) {
+    current_ = closure(
+      specialise(name, *t->second, identifier.type()),
+      llvm::Constant::getNullValue(llvm::Type::getInt8PtrTy(context_))
+    );
     return;
   }
-  current_ = builder_.CreateLoad(v, identifier.value());
+  current_ = nullptr;
 }
 
+// Literals are constants: small ones carry their bytes in the struct and
+// the rest point into a pool where each distinct literal appears once.
 void Compiler::visit(const String &string) {
+  auto value = string.value();
+  auto interned = strings_.find(value);
+  if(interned != strings_.end()) {
+    current_ = interned->second;
+    return;
+  }
 
+  auto i64 = llvm::Type::getInt64Ty(context_);
+  auto i8p = llvm::Type::getInt8PtrTy(context_);
+  llvm::Constant *data;
+  uint64_t word;
+  if(value.size() <= runtime::kSmallSize) {
+    uint64_t small[2] = {0, 0};
+    auto bytes = reinterpret_cast<char *>(small);
+    memcpy(bytes, value.data(), value.size());
+    bytes[runtime::kSmallSize] =
+      static_cast<char>((runtime::kSmall >> 56) | value.size());
+    data = llvm::ConstantExpr::getIntToPtr(llvm::ConstantInt::get(i64, small[0]),
+                                           i8p);
+    word = small[1];
+  } else {
+    auto bytes = llvm::ConstantDataArray::getString(context_, value, false);
+    auto pool = new llvm::GlobalVariable(*module_,
+                                         bytes->getType(),
+                                         true,
+                                         llvm::GlobalValue::PrivateLinkage,
+                                         bytes,
+                                         "str");
+    pool->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    data = llvm::ConstantExpr::getBitCast(pool, i8p);
+    word = runtime::kConstant | value.size();
+  }
+  auto literal = llvm::ConstantStruct::get(
+    string_type_,
+    {data, llvm::ConstantInt::get(i64, word)});
+  strings_[value] = literal;
+  current_ = literal;
 }
 
 void Compiler::visit(const Program &program) {
-
+  program.expression()->accept(*this);
 }
 
 void Compiler::visit(const Argument &argument) {
-
+  // Arguments are bound when their function is specialised.
 }
+
 // http://stackoverflow.com/questions/24429378/function-pointer-as-argument-to-call
 void Compiler::visit(const Function &function) {
+  current_ = closure(
+    specialise("lambda." + namer_.next(), function, function.type()),
+    llvm::Constant::getNullValue(llvm::Type::getInt8PtrTy(context_))
+  );
+}
+
+void Compiler::visit(const Closure &closure) {
+  auto name = closure.function()->internal_value();
+  auto t = templates_.find(name);
+  if(t == templates_.end()) {
+    current_ = nullptr;
+    perror("Compiler bug, closure over a function that was never lifted.");
+    return;
+  }
+  auto fn = specialise(name, *t->second, closure.type());
 
+  auto &captures = *closure.captures();
+  auto i8p = llvm::Type::getInt8PtrTy(context_);
+  llvm::Value *env = llvm::Constant::getNullValue(i8p);
+  if(!captures.empty()) {
+    auto type = environment(captures);
+    if(escapes_.local(closure)) {
+      env = CreateAlloca(builder_.GetInsertBlock()->getParent(), type, "env");
+      frame_.stack = true;
+    } else {
+      auto alloc = module_->getOrInsertFunction(
+        "goat_alloc",
+        llvm::FunctionType::get(i8p, {llvm::Type::getInt64Ty(context_)}, false)
+      );
+      auto size = builder_.CreateIntCast(llvm::ConstantExpr::getSizeOf(type),
+                                         llvm::Type::getInt64Ty(context_),
+                                         false);
+      env = builder_.CreateCall(alloc, {size}, "env");
+    }
+    auto record = builder_.CreateBitCast(env, type->getPointerTo());
+    env = builder_.CreateBitCast(env, i8p);
+    for(unsigned i = 0; i < captures.size(); i++) {
+      captures[i]->accept(*this);
+      if(!current_) {
+        return;
+      }
+      builder_.CreateStore(current_, builder_.CreateStructGEP(type, record, i));
+    }
+  }
+  current_ = this->closure(fn, env);
+}
+
+void Compiler::visit(const Label &label) {
+  label.expression()->accept(*this);
 }
 
 void Compiler::visit(const Application &application) {
+  std::vector<llvm::Value *> args;
+  for(auto l : *application.labels()) {
+    l.second->accept(*this);
+    if(!current_) {
+      return;
+    }
+    args.push_back(current_);
+  }
+
+  auto name = application.identifier()->internal_value();
+  auto self = name == frame_.name;
+  auto tail = tails_.tail(application);
+  auto type = resolve(application.function_type());
+  auto i8p = llvm::Type::getInt8PtrTy(context_);
+  llvm::Value *env = llvm::Constant::getNullValue(i8p);
+  // An environment on our stack has to outlive the call, and a jump back
+  // to the top would build the next one over it.
+  auto stack = [&](llvm::Value *value) {
+    return !llvm::isa<llvm::Constant>(value) && pointer(value->getType());
+  };
+  if(frame_.stack && std::any_of(args.begin(), args.end(), stack)) {
+    tail = false;
+  }
+
+  // Closures we saw being built are called directly, only the environment
+  // has to be fetched, and not even that if nothing was captured.
+  auto known = known_.find(name);
+  if(known != known_.end() && scope_.find(name) != scope_.end()) {
+    if(!known->second->captures()->empty()) {
+      application.identifier()->accept(*this);
+      env = builder_.CreateExtractValue(current_, 1);
+    }
+    name = known->second->function()->internal_value();
+  } else if(templates_.find(name) != templates_.end() &&
+            scope_.find(name) != scope_.end()) {
+    // A function calling itself, or one it captured, through the closure
+    // that holds its environment.
+    application.identifier()->accept(*this);
+    env = builder_.CreateExtractValue(current_, 1);
+  }
+  auto t = templates_.find(name);
+  if(t != templates_.end()) {
+    auto fn = specialise(name, *t->second, type);
+    if(frame_.stack && stack(env)) {
+      tail = false;
+    }
+    if(tail && self && fn == frame_.function) {
+      for(size_t i = 0; i < args.size(); i++) {
+        builder_.CreateStore(args[i], frame_.params[i]);
+      }
+      // The last time around is garbage unless an argument points into it.
+      if(frame_.region && std::none_of(args.begin(), args.end(), stack)) {
+        region("goat_region_reset", frame_.region);
+      }
+      builder_.CreateBr(frame_.body);
+      unreachable();
+      return;
+    }
+    args.insert(args.begin(), env);
+    call(fn->getFunctionType(), fn, args, tail);
+    return;
+  }
 
+  application.identifier()->accept(*this);
+  if(!current_) {
+    return;
+  }
+  auto signature = this->signature(std::get<FunctionType>(type));
+  auto code = builder_.CreateBitCast(builder_.CreateExtractValue(current_, 0),
+                                     signature->getPointerTo());
+  args.insert(args.begin(), builder_.CreateExtractValue(current_, 1));
+  call(signature, code, args, tail && !(frame_.stack && stack(args.front())));
+}
+
+// Both branches are evaluated, neither can fail or call anything.
+void Compiler::select(const Conditional &conditional, llvm::Value *condition) {
+  auto type = lower(conditional.type());
+  conditional.true_block()->accept(*this);
+  llvm::Value *true_value = current_;
+  if(!true_value) {
+    return;
+  }
+  conditional.false_block()->accept(*this);
+  llvm::Value *false_value = current_;
+  if(!false_value) {
+    return;
+  }
+  if(false_value->getType() != type) {
+    false_value = llvm::Constant::getNullValue(type);
+  }
+  current_ = builder_.CreateSelect(condition, true_value, false_value);
 }
 
 void Compiler::visit(const Conditional &conditional) {
+  conditional.expression()->accept(*this);
+  llvm::Value *condition = current_;
+  if(!condition) {
+    return;
+  }
+  if(condition->getType()->isDoubleTy()) {
+    condition = builder_.CreateFCmpONE(
+      condition,
+      llvm::ConstantFP::get(context_, llvm::APFloat(0.0))
+    );
+  }
 
+  if(options_.select) {
+    Cost cost([this](const Type &type) { return resolve(type); });
+    conditional.true_block()->accept(cost);
+    conditional.false_block()->accept(cost);
+    if(cost.cost() && *cost.cost() <= options_.select_cost) {
+      select(conditional, condition);
+      return;
+    }
+  }
+
+  llvm::Function *fn = builder_.GetInsertBlock()->getParent();
+  auto then_block = llvm::BasicBlock::Create(context_, "then", fn);
+  auto else_block = llvm::BasicBlock::Create(context_, "else", fn);
+  auto merge_block = llvm::BasicBlock::Create(context_, "merge", fn);
+  builder_.CreateCondBr(condition, then_block, else_block);
+
+  auto type = lower(conditional.type());
+  builder_.SetInsertPoint(then_block);
+  conditional.true_block()->accept(*this);
+  llvm::Value *true_value = current_;
+  if(!true_value) {
+    return;
+  }
+  then_block = builder_.GetInsertBlock();
+  builder_.CreateBr(merge_block);
+
+  builder_.SetInsertPoint(else_block);
+  conditional.false_block()->accept(*this);
+  llvm::Value *false_value = current_;
+  if(!false_value) {
+    return;
+  }
+  // A missing else block has no value of its own.
+  if(false_value->getType() != type) {
+    false_value = llvm::Constant::getNullValue(type);
+  }
+  else_block = builder_.GetInsertBlock();
+  builder_.CreateBr(merge_block);
+
+  builder_.SetInsertPoint(merge_block);
+  auto phi = builder_.CreatePHI(type, 2);
+  phi->addIncoming(true_value, then_block);
+  phi->addIncoming(false_value, else_block);
+  current_ = phi;
 }
 
-void Compiler::visit(const Operation &operation) {
+// Lowered to the canonical rotated loop LLVM expects: a guard, a single
+// block header with an i64 induction variable counting up from zero, and
+// the exit test on the latch.
+void Compiler::visit(const Loop &loop) {
+  auto i64 = llvm::Type::getInt64Ty(context_);
+  llvm::Value *count = integer(*loop.count());
+  if(!count) {
+    return;
+  }
+
+  llvm::Value *start = nullptr;
+  if(loop.counter() != nullptr) {
+    auto expression = loop.counter()->expression();
+    if(*expression == EmptyExpression()) {
+      start = llvm::ConstantInt::get(i64, 0);
+    } else if(ranges_.integral(*expression)) {
+      start = integer(*expression);
+    } else {
+      expression->accept(*this);
+      start = current_;
+    }
+    if(!start) {
+      current_ = nullptr;
+      return;
+    }
+  }
+
+  // What an iteration allocates is garbage by the next one unless the
+  // loop's value points into it.
+  llvm::Value *mark = nullptr;
+  Allocates allocates([this](const Type &type) { return resolve(type); });
+  loop.program()->accept(allocates);
+  if(allocates.allocates() && scalar(loop.program()->type())) {
+    mark = region("goat_region_enter");
+  }
 
+  llvm::Function *fn = builder_.GetInsertBlock()->getParent();
+  auto guard = builder_.GetInsertBlock();
+  auto body = llvm::BasicBlock::Create(context_, "loop", fn);
+  auto exit = llvm::BasicBlock::Create(context_, "loop.exit", fn);
+  auto zero = llvm::ConstantInt::get(i64, 0);
+  builder_.CreateCondBr(builder_.CreateICmpSGT(count, zero), body, exit);
+
+  builder_.SetInsertPoint(body);
+  auto index = builder_.CreatePHI(i64, 2, "index");
+  index->addIncoming(zero, guard);
+  if(start) {
+    auto name = loop.counter()->identifier()->internal_value();
+    if(start->getType() == i64) {
+      bind(name, builder_.CreateNSWAdd(start, index));
+    } else {
+      bind(name, builder_.CreateFAdd(
+        start,
+        builder_.CreateSIToFP(index, llvm::Type::getDoubleTy(context_))
+      ));
+    }
+  }
+  loop.program()->accept(*this);
+  llvm::Value *result = current_;
+  if(!result) {
+    return;
+  }
+  auto latch = builder_.GetInsertBlock();
+  auto next = builder_.CreateAdd(index,
+                                 llvm::ConstantInt::get(i64, 1),
+                                 "index.next",
+                                 true,
+                                 true);
+  index->addIncoming(next, latch);
+  if(mark) {
+    region("goat_region_reset", mark);
+  }
+  builder_.CreateCondBr(builder_.CreateICmpSLT(next, count), body, exit);
+
+  // A loop that never ran has no value of its own.
+  builder_.SetInsertPoint(exit);
+  auto phi = builder_.CreatePHI(result->getType(), 2);
+  phi->addIncoming(llvm::Constant::getNullValue(result->getType()), guard);
+  phi->addIncoming(result, latch);
+  if(mark) {
+    region("goat_region_leave", mark);
+  }
+  current_ = phi;
 }
 
-void Compiler::visit(const Declaration &declaration) {
-  declaration.expression()->accept(*this);
-  llvm::Value *exp = current_;
-  if(!exp) {
+void Compiler::visit(const Record &record) {
+  auto type = std::get<RecordType>(resolve(record.type()));
+  llvm::Value *base = nullptr;
+  std::optional<RecordType> rest;
+  if(*record.base() != EmptyExpression()) {
+    record.base()->accept(*this);
+    if(!current_) {
+      return;
+    }
+    base = current_;
+    rest = std::get<RecordType>(resolve(record.base()->type()));
+  }
+
+  // The n-th field with a label is the n-th new one if there are enough of
+  // those, and otherwise comes from the record being extended.
+  std::map<std::string, std::vector<llvm::Value *>> fields;
+  for(auto f : *record.fields()) {
+    f->accept(*this);
+    if(!current_) {
+      return;
+    }
+    fields[f->name()].push_back(current_);
+  }
+  llvm::Value *value = llvm::UndefValue::get(lower(type));
+  std::map<std::string, size_t> seen;
+  for(size_t i = 0; i < type.labels().size(); i++) {
+    auto &label = type.labels()[i];
+    auto n = seen[label]++;
+    llvm::Value *field;
+    if(n < fields[label].size()) {
+      field = fields[label][n];
+    } else if(base) {
+      auto at = *rest->find(label) + n - fields[label].size();
+      field = builder_.CreateExtractValue(base, at);
+    } else {
+      perror("Compiler bug, record is missing a field.");
+      current_ = nullptr;
+      return;
+    }
+    value = builder_.CreateInsertValue(value, field, i);
+  }
+  current_ = value;
+}
+
+void Compiler::visit(const Selection &selection) {
+  selection.record()->accept(*this);
+  if(!current_) {
+    return;
+  }
+  auto type = std::get<RecordType>(resolve(selection.record()->type()));
+  auto index = type.find(selection.label());
+  if(!index) {
+    perror("Compiler bug, selected a missing field.");
     current_ = nullptr;
     return;
   }
-  scope_.erase(declaration.identifier()->value());
+  current_ = builder_.CreateExtractValue(current_, *index);
+}
+
+void Compiler::visit(const Operation &operation) {
+  if(std::holds_alternative<StringType>(resolve(operation.type()))) {
+    concat(operation);
+    return;
+  }
+  if(ranges_.integral(operation)) {
+    llvm::Value *value = integer(operation);
+    current_ = value ?
+      builder_.CreateSIToFP(value, llvm::Type::getDoubleTy(context_)) :
+      nullptr;
+    return;
+  }
 
-  declaration.identifier()->accept(*this);
-  llvm::Value *var = current_;
-  if(!exp) {
+  operation.left()->accept(*this);
+  llvm::Value *left = current_;
+  operation.right()->accept(*this);
+  llvm::Value *right = current_;
+  if(!left || !right) {
     current_ = nullptr;
-    perror("Compiler bug, couldn't allocate a variable.");
     return;
   }
 
-  llvm::Function *fn = builder_.GetInsertBlock()->getParent();
-  llvm::AllocaInst *alloca = CreateAlloca(fn, context_, declaration.identifier()->value());
+  switch(operation.operation()) {
+  case Addition:
+    current_ = builder_.CreateFAdd(left, right);
+    break;
+  case Subtraction:
+    current_ = builder_.CreateFSub(left, right);
+    break;
+  case Division:
+    current_ = builder_.CreateFDiv(left, right);
+    break;
+  case Multiplication:
+    current_ = builder_.CreateFMul(left, right);
+    break;
+  }
+}
 
-  builder_.CreateStore(exp, alloca);
-  scope_[declaration.identifier()->value()] = var;
-  current_ = exp;
+void Compiler::visit(const Declaration &declaration) {
+  auto name = declaration.identifier()->internal_value();
+  // Functions are compiled on demand, once for each type they are used at.
+  auto function = std::dynamic_pointer_cast<Function>(declaration.value());
+  auto closure = std::dynamic_pointer_cast<Closure>(declaration.value());
+  if(closure) {
+    known_[name] = closure.get();
+  }
+  if(function) {
+    templates_[name] = function.get();
+  } else {
+    llvm::Value *value = nullptr;
+    if(ranges_.integral(*declaration.value())) {
+      value = integer(*declaration.value());
+    } else {
+      declaration.value()->accept(*this);
+      value = current_;
+    }
+    if(!value) {
+      current_ = nullptr;
+      perror("Compiler bug, couldn't allocate a variable.");
+      return;
+    }
+    bind(name, value);
+  }
+
+  declaration.expression()->accept(*this);
 }
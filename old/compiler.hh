@@ -1,35 +1,128 @@
 #ifndef SRC_COMPILER_
 #define SRC_COMPILER_
 
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
+#include "escape.hh"
 #include "inferer.hh"
 #include "node.hh"
+#include "ranges.hh"
+#include "tailcalls.hh"
+#include "util.hh"
 #include "visitor.hh"
 
 namespace goat {
 namespace compiling {
 
 // The actual compiler!
+//
+// Values are emitted unboxed using their solved types: numbers are doubles,
+// booleans are i1, strings are the runtime's goat_string, functions are a
+// {code, environment} pair and records are a struct of their fields in label
+// order. Functions are compiled lazily, once per concrete type they are used
+// at, so a polymorphic function gets a monomorphic copy for every
+// instantiation and calls to known functions are direct calls.
+//
+// Every compiled function takes its environment as a hidden first argument,
+// a single flat record of the variables the lifter found it captures. The
+// record lives on the stack when EscapeAnalysis shows the closure cannot
+// outlive the scope that builds it.
+// Arithmetic that IntegerRanges proves integral is done in i64.
+//
+// Functions returning nothing that can point into memory allocate in a
+// runtime region that is reset when they return, and again on each self
+// tail call that passes nothing that can. Loops likewise reset one on each
+// iteration when their value can't point into it.
+//
+// Self calls in tail position become a jump back to the top of the function
+// and other tail calls are musttail when the signatures allow it, so deep
+// recursion runs in constant stack space.
 class Compiler : public node::Visitor {
 public:
-  Compiler(std::set<inference::Substitution> substitutions) :
-    substitutions_(substitutions),
-    context_(),
-    builder_(context_),
-    module_(llvm::make_unique<llvm::Module>("Goat", context_)),
-    scope_(),
-    current_() {}
+  struct Options {
+    Options() :
+      select(true),
+      select_cost(8) {}
+    // Conditionals whose branches are cheap and can't fail evaluate both
+    // and pick one with a select instead of branching.
+    bool select;
+    // The most the two branches may cost together, roughly in instructions.
+    unsigned select_cost;
+  };
+  Compiler(std::set<inference::Substitution> substitutions,
+           Options options = Options());
   VisitorMethods
+  // Null if the program couldn't be compiled or the module doesn't verify.
+  llvm::Module *compile(std::shared_ptr<node::Program> program);
+  // What the verifier found wrong, if anything.
+  const std::string &error() const { return error_; }
 private:
-  std::set<inference::Substitution> substitutions_;
+  using Instantiation = std::map<std::string, inference::Type>;
+  // The function currently being compiled.
+  struct Frame {
+    std::string name;
+    llvm::Function *function;
+    llvm::BasicBlock *body;
+    std::vector<llvm::AllocaInst *> params;
+    // The region mark to reset to on return, if the function has a region.
+    llvm::Value *region;
+    // Whether a closure environment lives in the function's stack frame.
+    bool stack;
+  };
+  inference::Type resolve(const inference::Type &type) const;
+  llvm::Type *lower(const inference::Type &type);
+  llvm::FunctionType *signature(const inference::FunctionType &type);
+  bool scalar(const inference::Type &type) const;
+  void enter(const inference::Type &result);
+  llvm::Value *region(const char *name, llvm::Value *mark = nullptr);
+  void ret(llvm::Value *value);
+  llvm::Function *specialise(const std::string &name,
+                             const node::Function &function,
+                             const inference::Type &type);
+  llvm::StructType *environment(const node::IdentifierList &captures);
+  llvm::Value *closure(llvm::Function *function, llvm::Value *environment);
+  llvm::AllocaInst *bind(const std::string &name, llvm::Value *value);
+  void call(llvm::FunctionType *type,
+            llvm::Value *callee,
+            const std::vector<llvm::Value *> &args,
+            bool tail);
+  void unreachable();
+  llvm::Value *integer(const node::Node &node);
+  void concat(const node::Operation &operation);
+  void select(const node::Conditional &conditional, llvm::Value *condition);
+  Options options_;
+  IntegerRanges ranges_;
+  EscapeAnalysis escapes_;
+  TailCalls tails_;
+  Frame frame_;
+  Instantiation bindings_;
+  std::vector<Instantiation> instantiations_;
+  std::map<std::string, const node::Function *> templates_;
+  std::map<std::string, const node::Closure *> known_;
+  std::map<std::string, llvm::Constant *> strings_;
+  // By name, concrete type and the types of the captured variables.
+  std::map<std::tuple<std::string,
+                      inference::Type,
+                      std::vector<inference::Type>>,
+           llvm::Function *> specialisations_;
+  util::Namer namer_;
   llvm::LLVMContext context_;
   llvm::IRBuilder<> builder_;
   std::unique_ptr<llvm::Module> module_;
-  std::map<std::string, llvm::Value *> scope_;
+  llvm::StructType *string_type_;
+  llvm::StructType *closure_type_;
+  std::map<std::string, llvm::AllocaInst *> scope_;
   llvm::Value *current_;
+  std::string error_;
 };
 
 }
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <functional>
+#include <istream>
+#include <streambuf>
+#include <unordered_map>
+
+#include "document.hh"
+#include "renamer.hh"
+#include "visitor.hh"
+
+using namespace goat;
+using namespace goat::editing;
+using namespace goat::node;
+
+namespace {
+// A stream over part of the text, so lexing from the middle of it doesn't
+// copy the rest.
+class View : public std::streambuf {
+ public:
+  View(const std::string &text, size_t begin, size_t end) {
+    auto data = const_cast<char *>(text.data());
+    setg(data + begin, data + begin, data + end);
+  }
+};
+
+// Turns the lexer's lines and columns into offsets. Columns count bytes and
+// only newlines outside of strings start a line, so the text is scanned the
+// same way as far as it's needed.
+class Lines {
+ public:
+  Lines(const std::string &text, size_t begin) :
+    text_(text),
+    at_(begin),
+    starts_({begin}),
+    quoted_(false) {}
+  size_t offset(const position &where) {
+    size_t line = std::max(where.line, 1);
+    while(starts_.size() < line && at_ < text_.size()) {
+      char c = text_[at_++];
+      if(quoted_) {
+        if(c == '\\' && at_ < text_.size()) at_++;
+        else if(c == '"' || c == '\'') quoted_ = false;
+      } else if(c == '"' || c == '\'') {
+        quoted_ = true;
+      } else if(c == '\n') {
+        starts_.push_back(at_);
+      }
+    }
+    return starts_[std::min(line, starts_.size()) - 1] + where.column - 1;
+  }
+ private:
+  const std::string &text_;
+  size_t at_;
+  std::vector<size_t> starts_;
+  bool quoted_;
+};
+
+bool lex(const std::string &text,
+         size_t begin,
+         const std::function<bool(const Token &)> &token) {
+  View view(text, begin, text.size());
+  std::istream src(&view);
+  Lines lines(text, begin);
+  return driver::lex(&src, [&](parser::symbol_kind_type kind,
+                               const location &where) {
+    auto from = lines.offset(where.begin);
+    return token({kind, from, from + where.end.column - where.begin.column});
+  });
+}
+
+// Parses text[begin, end) on its own, adding where its functions are.
+std::shared_ptr<Program> parse(const std::string &text,
+                               size_t begin,
+                               size_t end,
+                               std::vector<Span> &spans) {
+  View view(text, begin, end);
+  std::istream src(&view);
+  std::shared_ptr<Program> program;
+  driver::Functions functions;
+  if(driver::parse(&src, program, &functions) != 0 || program == nullptr) {
+    return nullptr;
+  }
+  Lines lines(text, begin);
+  for(auto &found : functions.spans) {
+    auto to = lines.offset(found.second.end);
+    // done is always four bytes.
+    spans.push_back({found.first, lines.offset(found.second.begin),
+                     to - 4, to});
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) {
+    return a.begin < b.begin;
+  });
+  return program;
+}
+
+// Clones the tree with one function swapped for another, keeping track of
+// where the others went.
+class Splice : public TreeCloner {
+ public:
+  Splice(const Function *target, std::shared_ptr<Function> replacement) :
+    TreeCloner(),
+    moved(),
+    target_(target),
+    replacement_(replacement) {}
+  void visit(const Function &function) {
+    if(&function == target_) {
+      child_ = replacement_;
+      return;
+    }
+    TreeCloner::visit(function);
+    moved[&function] = static_cast<const Function *>(child_.get());
+  }
+  std::unordered_map<const Function *, const Function *> moved;
+ private:
+  const Function *target_;
+  std::shared_ptr<Function> replacement_;
+};
+}
+
+void Document::reload() {
+  tokens_.clear();
+  lexed_ = lex(text_, 0, [this](const Token &token) {
+    tokens_.push_back(token);
+    return true;
+  });
+  if(!lexed_) {
+    tokens_.clear();
+    parsed_ = false;
+    return;
+  }
+  reparse();
+}
+
+bool Document::reparse() {
+  std::vector<Span> spans;
+  auto program = parse(text_, 0, text_.size(), spans);
+  parsed_ = program != nullptr;
+  if(parsed_) {
+    program_ = program;
+    spans_ = std::move(spans);
+    typed_ = nullptr;
+  }
+  return parsed_;
+}
+
+Change Document::edit(size_t offset,
+                      size_t length,
+                      const std::string &text) {
+  offset = std::min(offset, text_.size());
+  length = std::min(length, text_.size() - offset);
+  auto shift = [&](size_t at) { return at + text.size() - length; };
+  auto next = text_;
+  next.replace(offset, length, text);
+
+  Change change = {0, nullptr, false, false};
+  if(!lexed_) {
+    text_ = std::move(next);
+    reload();
+    change.relexed = tokens_.size();
+    change.whole = true;
+    change.parsed = parsed_;
+    return change;
+  }
+
+  // Lexing starts a token early, an edit can join a token to the one before.
+  auto first = std::lower_bound(
+    tokens_.begin(), tokens_.end(), offset,
+    [](const Token &token, size_t at) { return token.end < at; });
+  if(first != tokens_.begin()) first--;
+  auto from = first == tokens_.end() ? offset : std::min(first->begin, offset);
+
+  // Stops at the first token past the edit that an old one shifts onto.
+  std::vector<Token> lexed;
+  auto old = first;
+  auto resynced = tokens_.end();
+  lexed_ = lex(next, from, [&](const Token &token) {
+    if(token.begin >= offset + text.size()) {
+      while(old != tokens_.end() &&
+            (old->begin < offset + length || shift(old->begin) < token.begin)) {
+        old++;
+      }
+      if(old != tokens_.end() && old->kind == token.kind &&
+         shift(old->begin) == token.begin && shift(old->end) == token.end) {
+        resynced = old;
+        return false;
+      }
+    }
+    lexed.push_back(token);
+    return true;
+  });
+  change.relexed = lexed.size();
+  if(!lexed_) {
+    text_ = std::move(next);
+    tokens_.clear();
+    parsed_ = false;
+    return change;
+  }
+
+  // The old bytes lexed again, spans outside of them are unharmed.
+  auto low = from;
+  auto high = resynced == tokens_.end() ? text_.size() : resynced->begin;
+  bool same = size_t(resynced - first) == lexed.size() &&
+    std::equal(first, resynced, lexed.begin(),
+               [&](const Token &a, const Token &b) {
+      return a.kind == b.kind &&
+        text_.compare(a.begin, a.end - a.begin,
+                      next, b.begin, b.end - b.begin) == 0;
+    });
+  auto span = std::upper_bound(
+    spans_.begin(), spans_.end(), low,
+    [](size_t at, const Span &span) { return at <= span.begin; });
+  while(span != spans_.begin() && (span - 1)->done < high) span--;
+  auto enclosing = span == spans_.begin() ? spans_.end() : span - 1;
+
+  // Spans with an end among the bytes lexed again move with their tokens
+  // when those are the same, and are parsed again below when they aren't.
+  auto moved = [&](size_t at) {
+    auto token = std::lower_bound(
+      first, resynced, at,
+      [](const Token &token, size_t at) { return token.begin < at; });
+    return token == resynced ? at : lexed[token - first].begin;
+  };
+  for(auto &s : spans_) {
+    if(s.begin >= high) s.begin = shift(s.begin);
+    else if(same && s.begin >= low) s.begin = moved(s.begin);
+    if(s.done >= high) {
+      s.done = shift(s.done);
+      s.end = shift(s.end);
+    } else if(same && s.done >= low) {
+      s.done = moved(s.done);
+      s.end = s.done + 4;
+    }
+  }
+  for(auto token = resynced; token != tokens_.end(); token++) {
+    token->begin = shift(token->begin);
+    token->end = shift(token->end);
+  }
+  tokens_.insert(tokens_.erase(first, resynced), lexed.begin(), lexed.end());
+  text_ = std::move(next);
+
+  if(same && parsed_) {
+    change.parsed = true;
+    return change;
+  }
+  if(!parsed_ || enclosing == spans_.end()) {
+    change.whole = true;
+    change.parsed = reparse();
+    return change;
+  }
+
+  std::vector<Span> inner;
+  auto program = parse(text_, enclosing->begin, enclosing->end, inner);
+  if(program == nullptr || program->expression()->kind() != Kind::Function) {
+    change.whole = true;
+    change.parsed = reparse();
+    return change;
+  }
+  auto function = std::static_pointer_cast<Function>(program->expression());
+  auto target = enclosing->function;
+  // The spans that start inside it are the ones nested in it.
+  auto begin = enclosing - spans_.begin();
+  auto end = std::lower_bound(
+    enclosing, spans_.end(), enclosing->end,
+    [](const Span &span, size_t at) { return span.begin < at; }) -
+    spans_.begin();
+  change.parsed = true;
+
+  if(*function == *target && size_t(end - begin) == inner.size()) {
+    for(size_t i = 0; i < inner.size(); i++) {
+      inner[i].function = spans_[begin + i].function;
+    }
+  } else {
+    Splice splice(target, function);
+    program_ = splice.clone(program_);
+    for(auto &s : spans_) {
+      auto moved = splice.moved.find(s.function);
+      if(moved != splice.moved.end()) s.function = moved->second;
+    }
+    typed_ = nullptr;
+    change.function = function;
+  }
+  spans_.erase(spans_.begin() + begin, spans_.begin() + end);
+  spans_.insert(spans_.begin() + begin, inner.begin(), inner.end());
+  return change;
+}
+
+std::shared_ptr<Program> Document::check(
+  std::set<inference::Substitution> &substitutions) {
+  if(typed_ == nullptr && program_ != nullptr) {
+    renaming::Renamer renamer;
+    inference::Inferer inferer;
+    typed_ = inferer.infer(renamer.rename(program_));
+    substitutions_ = inferer.solve();
+  }
+  substitutions = substitutions_;
+  return typed_;
+}
@@ -0,0 +1,100 @@
+#ifndef SRC_DOCUMENT_
+#define SRC_DOCUMENT_
+
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "driver.hh"
+#include "inferer.hh"
+#include "node.hh"
+
+namespace goat {
+namespace editing {
+
+// A token and the bytes of the text it covers.
+struct Token {
+  parser::symbol_kind_type kind;
+  size_t begin;
+  size_t end;
+};
+
+// Where a function is in the text, from its program keyword up to and
+// including its done.
+struct Span {
+  const node::Function *function;
+  size_t begin;
+  // Where its done starts.
+  size_t done;
+  size_t end;
+};
+
+// What an edit did.
+struct Change {
+  // Tokens lexed again, the rest were shifted.
+  size_t relexed;
+  // The function reparsed and spliced into the tree, null if the edit
+  // didn't change the tree or the whole text was parsed again.
+  std::shared_ptr<node::Function> function;
+  // Whether the whole text was parsed again.
+  bool whole;
+  // Whether the text parses, the last tree that did is kept if not.
+  bool parsed;
+};
+
+// A source being edited, for a REPL or an editor. It keeps the tokens and
+// the tree of the text and an edit only lexes the tokens around it again,
+// until the token stream lines back up with the old one. If the damaged
+// tokens all sit inside a function the smallest such function is parsed on
+// its own and spliced into the tree, otherwise the whole text is.
+//
+// Edits that only move tokens around, whitespace, leave the tree alone, as
+// do ones that reparse to an equal function. The program is only renamed
+// and inferred again once the tree has changed.
+class Document {
+ public:
+  explicit Document(std::string text) :
+    text_(text),
+    tokens_(),
+    spans_(),
+    program_(),
+    lexed_(false),
+    parsed_(false),
+    typed_(),
+    substitutions_() {
+    reload();
+  }
+  // Replaces `length` bytes at `offset` with `text`.
+  Change edit(size_t offset, size_t length, const std::string &text);
+  const std::string &text() const { return text_; }
+  const std::vector<Token> &tokens() const { return tokens_; }
+  // The tree of the last text that parsed, null if none has.
+  const std::shared_ptr<node::Program> &program() const { return program_; }
+  bool parsed() const { return parsed_; }
+  // The program renamed and typed with its solution, null if no text has
+  // parsed.
+  std::shared_ptr<node::Program> check(
+    std::set<inference::Substitution> &substitutions);
+ private:
+  // Lexes and parses the whole text.
+  void reload();
+  bool relex(size_t begin, size_t end);
+  bool reparse();
+  std::string text_;
+  std::vector<Token> tokens_;
+  // Sorted by where they start.
+  std::vector<Span> spans_;
+  std::shared_ptr<node::Program> program_;
+  // Whether the tokens and spans are those of the text.
+  bool lexed_;
+  bool parsed_;
+  std::shared_ptr<node::Program> typed_;
+  std::set<inference::Substitution> substitutions_;
+};
+
+}
+}
+
+#endif
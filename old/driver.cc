@@ -0,0 +1,306 @@
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "compiler.hh"
+#include "driver.hh"
+#include "eliminator.hh"
+#include "folder.hh"
+#include "inferer.hh"
+#include "inliner.hh"
+#include "lifter.hh"
+#include "renamer.hh"
+
+using namespace goat;
+using namespace goat::driver;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool read(const std::string &path, std::string &source, Report &report) {
+  std::ifstream file(path);
+  if(!file) {
+    report.error = "couldn't open the file";
+    return false;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  source = text.str();
+  return true;
+}
+
+// The module can't leave the thread's context, so it comes back as
+// bitcode.
+void compile_file(const std::string &path,
+                  const caching::Cache *cache,
+                  Report &report,
+                  std::string &bitcode,
+                  util::Pool &pool,
+                  const compiling::Compiler::Options &options) {
+  auto start = Clock::now();
+  report = {path, "", "", 0, 0, false, {}};
+  std::string source;
+  if(read(path, source, report)) {
+    compile(source, cache, report, bitcode, &pool, options);
+  }
+  report.seconds = since(start);
+}
+
+using Simplify = std::function<std::shared_ptr<node::Program>(
+  std::shared_ptr<node::Program>)>;
+
+// Parses, renames and infers a source with the imports in scope, running
+// `simplify` on the renamed tree.
+std::shared_ptr<node::Program> infer(
+  const std::string &source,
+  const serialising::Interface &imports,
+  const Simplify &simplify,
+  std::set<inference::Substitution> &substitutions,
+  Report &report,
+  util::Pool *pool) {
+  std::stringstream stream(source);
+  std::shared_ptr<node::Program> program;
+  if(parse(&stream, program) != 0 || program == nullptr) {
+    report.error = "syntax error";
+    return nullptr;
+  }
+  renaming::Renamer renamer;
+  if(pool != nullptr) {
+    renamer.parallel(pool);
+  }
+  inference::Inferer inferer;
+  for(auto &i : imports) {
+    inferer.assume(renamer.declare(i.first), i.second);
+  }
+  auto typed = inferer.infer(simplify(renamer.rename(program)));
+  substitutions = inferer.solve();
+  for(auto s : substitutions) {
+    if(s.is_error()) {
+      report.error = inferer.errors().empty() ? "type error"
+                                              : inferer.errors().front();
+      return nullptr;
+    }
+  }
+  std::stringstream printed;
+  printed << inference::resolve(substitutions, typed->type());
+  report.type = printed.str();
+  return typed;
+}
+}
+
+std::shared_ptr<node::Program> driver::check(
+  const std::string &source,
+  std::set<inference::Substitution> &substitutions,
+  Report &report,
+  util::Pool *pool) {
+  // Names are unique from here on, which every pass up to inference needs.
+  // Folding again after inlining picks up literal arguments, and sharing
+  // operations comes after both so it sees what they left. Declarations
+  // the others left unused go last.
+  auto simplify = [&](std::shared_ptr<node::Program> renamed) {
+    renamed = folding::Folder().fold(renamed);
+    inlining::Inliner inliner;
+    renamed = folding::Folder().fold(inliner.inline_calls(renamed));
+    report.inlining = inliner.statistics();
+    renamed = elimination::CommonSubexpressions().eliminate(renamed);
+    return elimination::DeadDeclarations().eliminate(renamed);
+  };
+  return infer(source, {}, simplify, substitutions, report, pool);
+}
+
+bool driver::compile(const std::string &source,
+                     const caching::Cache *cache,
+                     Report &report,
+                     std::string &bitcode,
+                     util::Pool *pool,
+                     const compiling::Compiler::Options &options) {
+  report.bytes = source.size();
+  std::string key;
+  if(cache != nullptr) {
+    key = caching::Cache::key(
+      source,
+      "select=" + std::to_string(options.select) +
+      " select_cost=" + std::to_string(options.select_cost));
+    if(auto entry = cache->find(key)) {
+      bitcode = entry->bitcode;
+      report.type = entry->type;
+      report.cached = true;
+      return true;
+    }
+  }
+
+  std::set<inference::Substitution> substitutions;
+  auto typed = check(source, substitutions, report, pool);
+  if(typed == nullptr) {
+    return false;
+  }
+  lifter::Lifter lifter;
+  compiling::Compiler compiler(substitutions, options);
+  auto module = compiler.compile(lifter.lift(typed));
+  if(module == nullptr) {
+    report.error = compiler.error().empty() ? "couldn't compile"
+                                            : compiler.error();
+    return false;
+  }
+  module->setModuleIdentifier(report.path);
+  llvm::raw_string_ostream out(bitcode);
+  llvm::WriteBitcodeToFile(*module, out);
+  out.flush();
+  if(cache != nullptr) {
+    cache->store(key, {bitcode, report.type});
+  }
+  return true;
+}
+
+std::unique_ptr<llvm::Module> driver::compile(
+  const std::vector<std::string> &paths,
+  util::Pool &pool,
+  llvm::LLVMContext &context,
+  std::vector<Report> &reports,
+  const caching::Cache *cache,
+  const compiling::Compiler::Options &options) {
+  reports.resize(paths.size());
+  std::vector<std::string> bitcode(paths.size());
+  std::vector<std::function<void()>> tasks;
+  for(size_t i = 0; i < paths.size(); i++) {
+    tasks.push_back([&, i]() {
+      compile_file(paths[i], cache, reports[i], bitcode[i], pool, options);
+    });
+  }
+  pool.run(std::move(tasks));
+
+  bool failed = false;
+  for(auto &r : reports) {
+    failed = failed || !r.error.empty();
+  }
+  if(failed) {
+    return nullptr;
+  }
+
+  // Linked in argument order, so the output doesn't depend on scheduling.
+  auto linked = std::make_unique<llvm::Module>("Goat", context);
+  llvm::Linker linker(*linked);
+  for(size_t i = 0; i < paths.size(); i++) {
+    auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode[i], paths[i]),
+      context);
+    if(!module) {
+      reports[i].error = llvm::toString(module.takeError());
+      return nullptr;
+    }
+    (*module)->getFunction("goat_main")->setName("goat_main_" +
+                                                 std::to_string(i));
+    if(linker.linkInModule(std::move(*module))) {
+      reports[i].error = "couldn't link";
+      return nullptr;
+    }
+  }
+  return linked;
+}
+
+bool driver::import(const std::string &path,
+                    serialising::Interface &imports,
+                    std::string &error) {
+  auto mapping = serialising::Mapping::open(path);
+  if(mapping == nullptr) {
+    error = "couldn't open the file";
+    return false;
+  }
+  auto image = serialising::Image::view(mapping->data(), mapping->size());
+  if(!image) {
+    error = "not an image";
+    return false;
+  }
+  auto interface = image->interface();
+  imports.insert(imports.end(), interface.begin(), interface.end());
+  return true;
+}
+
+bool driver::interface(const std::vector<std::string> &paths,
+                       util::Pool &pool,
+                       const serialising::Interface &imports,
+                       std::vector<Report> &reports,
+                       serialising::Interface &exports) {
+  reports.resize(paths.size());
+  std::vector<serialising::Interface> found(paths.size());
+  std::vector<std::function<void()>> tasks;
+  for(size_t i = 0; i < paths.size(); i++) {
+    tasks.push_back([&, i]() {
+      auto start = Clock::now();
+      auto &report = reports[i];
+      report = {paths[i], "", "", 0, 0, false, {}};
+      std::string source;
+      if(read(paths[i], source, report)) {
+        report.bytes = source.size();
+        // As written, simplifying could drop declarations nothing uses.
+        std::set<inference::Substitution> substitutions;
+        auto same = [](std::shared_ptr<node::Program> renamed) {
+          return renamed;
+        };
+        auto typed = infer(source, imports, same, substitutions, report,
+                           &pool);
+        if(typed != nullptr) {
+          found[i] = serialising::exports(*typed, substitutions);
+        }
+      }
+      report.seconds = since(start);
+    });
+  }
+  pool.run(std::move(tasks));
+
+  bool failed = false;
+  for(auto &r : reports) {
+    failed = failed || !r.error.empty();
+  }
+  if(failed) {
+    return false;
+  }
+  for(auto &f : found) {
+    exports.insert(exports.end(), f.begin(), f.end());
+  }
+  return true;
+}
+
+void driver::report(std::ostream &out,
+                    const std::vector<Report> &reports,
+                    double seconds) {
+  size_t bytes = 0;
+  size_t failed = 0;
+  inlining::Inliner::Statistics inlining = {0, 0, 0, 0};
+  out << std::fixed << std::setprecision(2);
+  for(auto &r : reports) {
+    bytes += r.bytes;
+    inlining.calls += r.inlining.calls;
+    inlining.inlined += r.inlining.inlined;
+    inlining.too_big += r.inlining.too_big;
+    inlining.recursive += r.inlining.recursive;
+    out << r.path << ": " << r.bytes << " bytes in "
+        << r.seconds * 1000 << "ms";
+    if(r.error.empty()) {
+      out << " (" << r.bytes / r.seconds / 1024 << " KiB/s"
+          << (r.cached ? ", cached" : "") << "): " << r.type << "\n";
+    } else {
+      failed++;
+      out << ", " << r.error << "\n";
+    }
+  }
+  out << reports.size() << " files, " << failed << " failed, "
+      << bytes << " bytes in " << seconds * 1000 << "ms ("
+      << reports.size() / seconds << " files/s, "
+      << bytes / seconds / 1024 << " KiB/s)\n";
+  out << inlining.inlined << " of " << inlining.calls << " calls inlined, "
+      << inlining.too_big << " too big, " << inlining.recursive
+      << " recursive\n";
+}
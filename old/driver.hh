@@ -1,11 +1,25 @@
 #ifndef GOAT_DRIVER_HH_
 #define GOAT_DRIVER_HH_
 
+#include <functional>
 #include <istream>
 #include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
 
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "cache.hh"
+#include "compiler.hh"
+#include "image.hh"
+#include "inferer.hh"
+#include "inliner.hh"
 #include "node.hh"
 #include "parser.tab.hh"
+#include "pool.hh"
 
 // this is a silly place to put this, bison
 #define YY_DECL goat::parser::symbol_type yylex(void *yyscanner, \
@@ -15,8 +29,97 @@ YY_DECL;
 namespace goat {
 namespace driver {
 
+// Where a parse found each function, innermost first.
+struct Functions {
+  std::vector<std::pair<const node::Function *, location>> spans;
+};
+
 int parse(std::istream *src,
-          std::shared_ptr<goat::node::Program> &result);
+          std::shared_ptr<goat::node::Program> &result,
+          Functions *functions = nullptr);
+
+// Called with every token and where it is, returns false to stop lexing.
+using Tokens = std::function<bool(parser::symbol_kind_type,
+                                  const location &)>;
+
+// Lexes `src` without parsing it. False if it has an invalid character.
+bool lex(std::istream *src, const Tokens &tokens);
+
+// How compiling one file went.
+struct Report {
+  std::string path;
+  // Empty if the file compiled.
+  std::string error;
+  // The solved type of the program.
+  std::string type;
+  size_t bytes;
+  double seconds;
+  // Whether it came out of the cache.
+  bool cached;
+  // What inlining did, nothing if it came out of the cache.
+  inlining::Inliner::Statistics inlining;
+};
+
+// Parses, renames, simplifies and infers a source, giving back the typed
+// program and its solution, or null with the error in the report. In
+// between renaming and inference constants fold, small functions are
+// inlined, constants fold again, repeated operations are shared and unused
+// declarations removed.
+// Big programs are renamed in parallel when there is a pool.
+std::shared_ptr<node::Program> check(
+  const std::string &source,
+  std::set<inference::Substitution> &substitutions,
+  Report &report,
+  util::Pool *pool = nullptr);
+
+// Compiles one source to bitcode in a context of its own, going through the
+// cache if there is one. False if it failed, see the report.
+bool compile(const std::string &source,
+             const caching::Cache *cache,
+             Report &report,
+             std::string &bitcode,
+             util::Pool *pool = nullptr,
+             const compiling::Compiler::Options &options =
+               compiling::Compiler::Options());
+
+// Compiles every file on the pool, each with its own LLVMContext, and links
+// the results into one module in `context`. The entry point of the n-th file
+// is renamed goat_main_n so they can share a module; everything else is
+// internal already. Returns null if any file failed, see the reports.
+//
+// Files found in the cache skip straight to linking, and the rest are
+// added to it.
+std::unique_ptr<llvm::Module> compile(const std::vector<std::string> &paths,
+                                      util::Pool &pool,
+                                      llvm::LLVMContext &context,
+                                      std::vector<Report> &reports,
+                                      const caching::Cache *cache = nullptr,
+                                      const compiling::Compiler::Options
+                                        &options =
+                                        compiling::Compiler::Options());
+
+// Adds the exports of the image or interface at `path` to `imports`. False
+// with the error if it couldn't be read.
+bool import(const std::string &path,
+            serialising::Interface &imports,
+            std::string &error);
+
+// Checks every file on the pool with the imports in scope and gathers the
+// principal types of their top level declarations into `exports`, in
+// argument order. Files are inferred as written, without simplifying, and
+// nothing is compiled since the imports have no code here. False if any
+// file failed, see the reports.
+bool interface(const std::vector<std::string> &paths,
+               util::Pool &pool,
+               const serialising::Interface &imports,
+               std::vector<Report> &reports,
+               serialising::Interface &exports);
+
+// Per file and total throughput, `seconds` being the wall time for the lot,
+// and what inlining did across them.
+void report(std::ostream &out,
+            const std::vector<Report> &reports,
+            double seconds);
 
 }  // namespace goat
 }  // namespace driver
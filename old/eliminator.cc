@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <set>
+
+#include "eliminator.hh"
+
+using namespace goat;
+using namespace node;
+using namespace elimination;
+
+namespace {
+size_t combine(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+class Hasher : public Visitor {
+ public:
+  Hasher() : hash_(0) {}
+  void visit(const Identifier &identifier) {
+    hash_ = combine(hash_, std::hash<std::string>()(identifier.internal_value()));
+  }
+  void visit(const Number &number) {
+    uint64_t bits = 0;
+    double value = number.value();
+    if(!std::isnan(value)) {
+      memcpy(&bits, &value, sizeof(bits));
+    }
+    hash_ = combine(hash_, std::hash<uint64_t>()(bits));
+  }
+  void visit(const String &string) {
+    hash_ = combine(hash_, std::hash<std::string>()(string.value()));
+  }
+  void visit(const Selection &selection) {
+    hash_ = combine(hash_, std::hash<std::string>()(selection.label()));
+    Visitor::visit(selection);
+  }
+  void visit(const Operation &operation) {
+    hash_ = combine(hash_, operation.operation() + 1);
+    Visitor::visit(operation);
+  }
+  size_t hash() const { return hash_; }
+ private:
+  size_t hash_;
+};
+
+// Whether an expression can be shared: nothing but arithmetic on names and
+// literals. Also measures it.
+class Simple : public Visitor {
+ public:
+  Simple() : simple_(true), size_(0) {}
+  void visit(const EmptyExpression &empty) { simple_ = false; }
+  void visit(const Identifier &identifier) { size_++; }
+  void visit(const Number &number) { size_++; }
+  void visit(const String &string) { size_++; }
+  void visit(const Program &program) { simple_ = false; }
+  void visit(const Argument &argument) { simple_ = false; }
+  void visit(const Function &function) { simple_ = false; }
+  void visit(const Closure &closure) { simple_ = false; }
+  void visit(const Label &label) { simple_ = false; }
+  void visit(const Application &application) { simple_ = false; }
+  void visit(const Conditional &conditional) { simple_ = false; }
+  void visit(const Loop &loop) { simple_ = false; }
+  void visit(const Record &record) { simple_ = false; }
+  void visit(const Declaration &declaration) { simple_ = false; }
+  void visit(const Selection &selection) {
+    size_++;
+    Visitor::visit(selection);
+  }
+  void visit(const Operation &operation) {
+    size_++;
+    Visitor::visit(operation);
+  }
+  bool simple() const { return simple_; }
+  size_t size() const { return size_; }
+ private:
+  bool simple_;
+  size_t size_;
+};
+
+using Counts = std::unordered_map<std::shared_ptr<Node>,
+                                  size_t,
+                                  StructuralHash,
+                                  StructuralEqual>;
+
+class Identifiers : public Visitor {
+ public:
+  void visit(const Identifier &identifier) {
+    names.insert(identifier.internal_value());
+  }
+  std::set<std::string> names;
+};
+
+// Every shared_ptr child of an expression, which is how an operation can
+// be looked up in a Counts.
+void children(const Node &node,
+              const std::function<void(const std::shared_ptr<Node> &)> &f) {
+  if(auto o = dynamic_cast<const Operation *>(&node)) {
+    f(o->left());
+    f(o->right());
+  } else if(auto s = dynamic_cast<const Selection *>(&node)) {
+    f(s->record());
+  } else if(auto a = dynamic_cast<const Application *>(&node)) {
+    for(auto l : *a->labels()) f(l.second->expression());
+  } else if(auto r = dynamic_cast<const Record *>(&node)) {
+    for(auto l : *r->fields()) f(l->expression());
+    f(r->base());
+  } else if(auto d = dynamic_cast<const Declaration *>(&node)) {
+    f(d->value());
+    f(d->expression());
+  } else if(auto c = dynamic_cast<const Conditional *>(&node)) {
+    f(c->expression());
+  } else if(auto l = dynamic_cast<const Loop *>(&node)) {
+    f(l->count());
+  } else if(auto p = dynamic_cast<const Program *>(&node)) {
+    f(p->expression());
+  }
+}
+
+// Counts every simple operation at or under a node, stopping at blocks.
+void occurrences(const std::shared_ptr<Node> &node, Counts &counts) {
+  if(std::dynamic_pointer_cast<Operation>(node)) {
+    Simple simple;
+    node->accept(simple);
+    if(simple.simple()) {
+      counts[node]++;
+    }
+  }
+  children(*node, [&counts](auto &child) { occurrences(child, counts); });
+}
+
+// Names declared at or under a node, stopping at blocks.
+void declared(const std::shared_ptr<Node> &node, std::set<std::string> &names) {
+  if(auto d = std::dynamic_pointer_cast<Declaration>(node)) {
+    names.insert(d->identifier()->internal_value());
+  }
+  children(*node, [&names](auto &child) { declared(child, names); });
+}
+}
+
+size_t StructuralHash::operator()(const std::shared_ptr<Node> &node) const {
+  Hasher hasher;
+  node->accept(hasher);
+  return hasher.hash();
+}
+
+std::shared_ptr<Program> CommonSubexpressions::eliminate(
+  std::shared_ptr<Program> program) {
+  return block(*program);
+}
+
+std::shared_ptr<Program> CommonSubexpressions::block(const Program &program) {
+  Counts counts;
+  occurrences(program.expression(), counts);
+
+  // Biggest first: once an expression is shared, the copies of the
+  // operations inside it go away with it.
+  std::vector<std::pair<std::shared_ptr<Node>, size_t>> shared;
+  for(auto &c : counts) {
+    if(c.second > 1) {
+      Simple simple;
+      c.first->accept(simple);
+      shared.push_back({c.first, simple.size()});
+    }
+  }
+  std::stable_sort(shared.begin(), shared.end(), [](auto &a, auto &b) {
+    return a.second > b.second;
+  });
+
+  // Each is declared right after the last declaration along the block's
+  // chain of declarations that binds a name it uses.
+  std::map<std::string, size_t> binders;
+  size_t index = 0;
+  for(auto d = std::dynamic_pointer_cast<Declaration>(program.expression());
+      d;
+      d = std::dynamic_pointer_cast<Declaration>(d->expression())) {
+    binders[d->identifier()->internal_value()] = ++index;
+  }
+  // Names declared off the chain, inside a value, aren't in scope anywhere
+  // along it, so nothing using them can go there.
+  std::set<std::string> nested;
+  declared(program.expression(), nested);
+  for(auto &b : binders) {
+    nested.erase(b.first);
+  }
+
+  // Bindings from enclosing blocks may not be in scope yet.
+  auto outer = bindings_;
+  bindings_.clear();
+  std::vector<std::pair<std::shared_ptr<Node>, size_t>> chosen;
+  for(auto &s : shared) {
+    auto copies = counts[s.first];
+    if(copies < 2) {
+      continue;
+    }
+    Identifiers identifiers;
+    s.first->accept(identifiers);
+    if(std::any_of(identifiers.names.begin(), identifiers.names.end(),
+                   [&](auto &name) { return nested.count(name) > 0; })) {
+      continue;
+    }
+    Counts inner;
+    children(*s.first, [&inner](auto &child) { occurrences(child, inner); });
+    for(auto &i : inner) {
+      counts[i.first] -= std::min(counts[i.first], i.second * (copies - 1));
+    }
+    chosen.push_back(s);
+  }
+
+  for(auto c = chosen.rbegin(); c != chosen.rend(); c++) {
+    auto identifier = std::make_shared<Identifier>("cse", "cse." + namer_.next());
+    Identifiers identifiers;
+    c->first->accept(identifiers);
+    size_t position = 0;
+    for(auto &name : identifiers.names) {
+      auto binder = binders.find(name);
+      if(binder != binders.end()) {
+        position = std::max(position, binder->second);
+      }
+    }
+    bindings_[c->first] = {nullptr, identifier, position};
+  }
+  // Values are built smallest first, so they can use each other.
+  std::map<size_t, std::vector<Binding>> positions;
+  for(auto c = chosen.rbegin(); c != chosen.rend(); c++) {
+    auto &operation = static_cast<const Operation &>(*c->first);
+    TreeCloner::visit(operation);
+    auto &binding = bindings_[c->first];
+    binding.expression = child_;
+    positions[binding.position].push_back(binding);
+  }
+
+  auto result = std::make_shared<Program>(
+    spine(program.expression(), 0, positions));
+  bindings_ = outer;
+  return result;
+}
+
+// Rebuilds the chain of declarations from `index` on, with the bindings
+// that go there wrapped around it, smallest outermost.
+std::shared_ptr<Node> CommonSubexpressions::spine(
+  const std::shared_ptr<Node> &node,
+  size_t index,
+  const std::map<size_t, std::vector<Binding>> &positions) {
+  std::shared_ptr<Node> rest;
+  auto declaration = std::dynamic_pointer_cast<Declaration>(node);
+  if(declaration) {
+    declaration->identifier()->accept(*this);
+    auto identifier = std::static_pointer_cast<Identifier>(child_);
+    declaration->value()->accept(*this);
+    auto value = child_;
+    rest = std::make_shared<Declaration>(
+      identifier,
+      value,
+      spine(declaration->expression(), index + 1, positions));
+  } else {
+    node->accept(*this);
+    rest = child_;
+  }
+
+  auto here = positions.find(index);
+  if(here != positions.end()) {
+    for(auto b = here->second.rbegin(); b != here->second.rend(); b++) {
+      rest = std::make_shared<Declaration>(b->identifier,
+                                           b->expression,
+                                           rest);
+    }
+  }
+  return rest;
+}
+
+void CommonSubexpressions::visit(const Function &function) {
+  auto args = std::make_shared<ArgumentList>();
+  for(auto a : *function.arguments()) {
+    a->accept(*this);
+    args->push_back(std::static_pointer_cast<Argument>(child_));
+  }
+  child_ = std::make_shared<Function>(args,
+                                      block(*function.program()),
+                                      function.type(),
+                                      function.captures());
+}
+
+void CommonSubexpressions::visit(const Conditional &conditional) {
+  conditional.expression()->accept(*this);
+  auto expression = child_;
+  auto true_block = block(*conditional.true_block());
+  auto false_block = block(*conditional.false_block());
+  child_ = std::make_shared<Conditional>(expression, true_block, false_block);
+}
+
+void CommonSubexpressions::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = child_;
+  auto program = block(*loop.program());
+  if(loop.counter() == nullptr) {
+    child_ = std::make_shared<Loop>(count, program);
+    return;
+  }
+  loop.counter()->accept(*this);
+  child_ = std::make_shared<Loop>(
+    count,
+    std::static_pointer_cast<Argument>(child_),
+    program);
+}
+
+void CommonSubexpressions::visit(const Operation &operation) {
+  // Looked up through a copy, since the table is keyed by shared_ptr.
+  auto key = std::make_shared<Operation>(operation.left(),
+                                         operation.right(),
+                                         operation.operation(),
+                                         operation.type());
+  auto binding = bindings_.find(key);
+  if(binding != bindings_.end() && binding->second.expression) {
+    child_ = binding->second.identifier;
+    return;
+  }
+  TreeCloner::visit(operation);
+}
+
+namespace {
+// Counts how often each name is used, leaving out where it is bound.
+class Uses : public Visitor {
+ public:
+  Uses(std::map<std::string, size_t> &uses, bool release) :
+    uses_(uses),
+    release_(release) {}
+  void visit(const Identifier &identifier) {
+    if(release_) {
+      uses_[identifier.internal_value()]--;
+    } else {
+      uses_[identifier.internal_value()]++;
+    }
+  }
+  void visit(const Argument &argument) {
+    argument.expression()->accept(*this);
+  }
+  void visit(const Declaration &declaration) {
+    declaration.value()->accept(*this);
+    declaration.expression()->accept(*this);
+  }
+ private:
+  std::map<std::string, size_t> &uses_;
+  bool release_;
+};
+
+// Whether evaluating an expression calls anything. Making a function
+// doesn't run its body.
+class Calls : public Visitor {
+ public:
+  Calls() : found_(false) {}
+  void visit(const Function &function) {}
+  void visit(const Application &application) { found_ = true; }
+  bool found() const { return found_; }
+ private:
+  bool found_;
+};
+}
+
+std::shared_ptr<Program> DeadDeclarations::eliminate(
+  std::shared_ptr<Program> program) {
+  Uses uses(uses_, false);
+  program->accept(uses);
+  return clone(program);
+}
+
+// The expression goes first, so declarations only used by dead ones are
+// dead by the time they are looked at.
+void DeadDeclarations::visit(const Declaration &declaration) {
+  declaration.expression()->accept(*this);
+  auto expression = child_;
+  auto name = declaration.identifier()->internal_value();
+
+  Calls calls;
+  declaration.value()->accept(calls);
+  if(!calls.found()) {
+    // A value referring to itself is still dead if nothing else does.
+    std::map<std::string, size_t> inside;
+    Uses own(inside, false);
+    declaration.value()->accept(own);
+    if(uses_[name] == inside[name]) {
+      Uses release(uses_, true);
+      declaration.value()->accept(release);
+      child_ = expression;
+      return;
+    }
+  }
+
+  declaration.identifier()->accept(*this);
+  auto identifier = std::static_pointer_cast<Identifier>(child_);
+  declaration.value()->accept(*this);
+  child_ = std::make_shared<Declaration>(identifier, child_, expression);
+}
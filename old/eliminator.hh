@@ -0,0 +1,84 @@
+#ifndef SRC_ELIMINATOR_
+#define SRC_ELIMINATOR_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "node.hh"
+#include "visitor.hh"
+#include "util.hh"
+
+namespace goat {
+namespace elimination {
+
+// Hashes an expression made only of operations, selections, identifiers and
+// literals, consistently with Node::operator==.
+struct StructuralHash {
+  size_t operator()(const std::shared_ptr<node::Node> &node) const;
+};
+
+struct StructuralEqual {
+  bool operator()(const std::shared_ptr<node::Node> &a,
+                  const std::shared_ptr<node::Node> &b) const {
+    return *a == *b;
+  }
+};
+
+// Binds operations that are computed more than once in the same block to a
+// new name, declared as soon as everything they mention is in scope. A block
+// is a function or loop body, a conditional branch or the whole program;
+// nothing moves between blocks, so nothing is computed on a path that
+// didn't compute it before. Runs on the renamed tree.
+class CommonSubexpressions : public node::TreeCloner {
+ public:
+  CommonSubexpressions() :
+    TreeCloner(),
+    bindings_(),
+    namer_() {}
+  void visit(const node::Function &function);
+  void visit(const node::Conditional &conditional);
+  void visit(const node::Loop &loop);
+  void visit(const node::Operation &operation);
+  std::shared_ptr<node::Program> eliminate(
+    std::shared_ptr<node::Program> program);
+ private:
+  struct Binding {
+    std::shared_ptr<node::Node> expression;
+    std::shared_ptr<node::Identifier> identifier;
+    // Where along the block's chain of declarations it goes.
+    size_t position;
+  };
+  using Bindings = std::unordered_map<std::shared_ptr<node::Node>,
+                                      Binding,
+                                      StructuralHash,
+                                      StructuralEqual>;
+  std::shared_ptr<node::Program> block(const node::Program &program);
+  std::shared_ptr<node::Node> spine(
+    const std::shared_ptr<node::Node> &node,
+    size_t index,
+    const std::map<size_t, std::vector<Binding>> &positions);
+  Bindings bindings_;
+  util::Namer namer_;
+};
+
+// Removes declarations nothing refers to whose values have no effect,
+// which here is any value that makes no calls, since a call may not return.
+class DeadDeclarations : public node::TreeCloner {
+ public:
+  DeadDeclarations() :
+    TreeCloner(),
+    uses_() {}
+  void visit(const node::Declaration &declaration);
+  std::shared_ptr<node::Program> eliminate(
+    std::shared_ptr<node::Program> program);
+ private:
+  std::map<std::string, size_t> uses_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "escape.hh"
+#include "node.hh"
+
+using namespace goat::node;
+using namespace goat::compiling;
+
+void EscapeAnalysis::analyse(const Program &program) {
+  size_t escaped;
+  do {
+    escaped = escaped_.size();
+    passed_.clear();
+    program.accept(*this);
+  } while(escaped_.size() != escaped);
+}
+
+bool EscapeAnalysis::local(const Closure &closure) const {
+  auto bound = bound_.find(&closure);
+  if(bound != bound_.end()) {
+    return escaped_.find(bound->second) == escaped_.end();
+  }
+  for(auto p : passed_) {
+    if(std::get<0>(p) == &closure) {
+      return !escapes(*std::get<1>(p), std::get<2>(p));
+    }
+  }
+  return false;
+}
+
+const Function *EscapeAnalysis::target(const std::string &name) const {
+  auto known = known_.find(name);
+  auto function = functions_.find(
+    known == known_.end() ? name : known->second
+  );
+  return function == functions_.end() ? nullptr : function->second;
+}
+
+bool EscapeAnalysis::escapes(const Function &function,
+                             const std::string &label) const {
+  for(auto a : *function.arguments()) {
+    if(a->identifier()->value() == label) {
+      return escaped_.find(a->identifier()->internal_value()) != escaped_.end();
+    }
+  }
+  return true;
+}
+
+void EscapeAnalysis::visit(const Identifier &identifier) {
+  escaped_.insert(identifier.internal_value());
+}
+
+void EscapeAnalysis::visit(const Argument &argument) {
+  argument.expression()->accept(*this);
+}
+
+// Anything captured is stored into an environment we know nothing about.
+void EscapeAnalysis::visit(const Closure &closure) {
+  for(auto c : *closure.captures()) {
+    c->accept(*this);
+  }
+}
+
+void EscapeAnalysis::visit(const Application &application) {
+  auto callee = target(application.identifier()->internal_value());
+  for(auto l : *application.labels()) {
+    auto expression = l.second->expression();
+    if(!callee || escapes(*callee, l.first)) {
+      expression->accept(*this);
+      continue;
+    }
+    auto closure = std::dynamic_pointer_cast<Closure>(expression);
+    if(closure) {
+      passed_.push_back({closure.get(), callee, l.first});
+      closure->accept(*this);
+    } else if(!std::dynamic_pointer_cast<Identifier>(expression)) {
+      expression->accept(*this);
+    }
+  }
+}
+
+void EscapeAnalysis::visit(const Declaration &declaration) {
+  auto name = declaration.identifier()->internal_value();
+  auto function = std::dynamic_pointer_cast<Function>(declaration.value());
+  if(function) {
+    functions_[name] = function.get();
+  }
+  auto closure = std::dynamic_pointer_cast<Closure>(declaration.value());
+  if(closure) {
+    known_[name] = closure->function()->internal_value();
+    bound_[closure.get()] = name;
+  }
+  declaration.value()->accept(*this);
+  declaration.expression()->accept(*this);
+}
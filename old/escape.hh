@@ -0,0 +1,53 @@
+#ifndef SRC_ESCAPE_
+#define SRC_ESCAPE_
+
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "node.hh"
+#include "visitor.hh"
+
+namespace goat {
+namespace compiling {
+
+// Finds the closures in a lifted program that never outlive the scope that
+// builds them, so their environments can live on the stack.
+//
+// A name escapes when it is used as anything other than the callee of an
+// application, or as an argument to a known function whose parameter
+// escapes in turn. Parameter escapes feed back into their callers, so the
+// analysis is iterated until nothing new escapes.
+class EscapeAnalysis : public node::Visitor {
+public:
+  EscapeAnalysis() :
+    functions_(),
+    known_(),
+    bound_(),
+    passed_(),
+    escaped_() {}
+  void visit(const node::Identifier &identifier);
+  void visit(const node::Argument &argument);
+  void visit(const node::Closure &closure);
+  void visit(const node::Application &application);
+  void visit(const node::Declaration &declaration);
+  void analyse(const node::Program &program);
+  bool local(const node::Closure &closure) const;
+private:
+  const node::Function *target(const std::string &name) const;
+  bool escapes(const node::Function &function, const std::string &label) const;
+  std::map<std::string, const node::Function *> functions_;
+  std::map<std::string, std::string> known_;
+  std::map<const node::Closure *, std::string> bound_;
+  std::vector<std::tuple<const node::Closure *,
+                         const node::Function *,
+                         std::string>> passed_;
+  std::set<std::string> escaped_;
+};
+
+}
+}
+
+#endif
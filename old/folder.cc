@@ -0,0 +1,133 @@
+#include <cmath>
+
+#include "folder.hh"
+
+using namespace goat;
+using namespace node;
+using namespace folding;
+
+static bool literal(const std::shared_ptr<Node> &node) {
+  return std::dynamic_pointer_cast<Number>(node) ||
+    std::dynamic_pointer_cast<String>(node);
+}
+
+// Whether the node is a number before inference has looked at it. Any
+// operation but addition makes its operands and result numbers, so
+// dropping one of those loses no constraint.
+static bool numeric(const std::shared_ptr<Node> &node) {
+  if(std::dynamic_pointer_cast<Number>(node)) {
+    return true;
+  }
+  auto operation = std::dynamic_pointer_cast<Operation>(node);
+  return operation && operation->operation() != Addition;
+}
+
+std::shared_ptr<Program> Folder::fold(std::shared_ptr<Program> program) {
+  return clone(program);
+}
+
+void Folder::visit(const Identifier &identifier) {
+  auto constant = constants_.find(identifier.internal_value());
+  if(constant != constants_.end()) {
+    child_ = constant->second;
+    return;
+  }
+  TreeCloner::visit(identifier);
+}
+
+// The callee has to stay an identifier, so only the arguments fold.
+void Folder::visit(const Application &application) {
+  auto args = std::make_shared<Labels>();
+  for(auto l : *application.labels()) {
+    l.second->accept(*this);
+    args->insert({l.first, std::static_pointer_cast<Label>(child_)});
+  }
+  child_ = std::make_shared<Application>(
+    std::make_shared<Identifier>(application.identifier()->value(),
+                                 application.identifier()->internal_value()),
+    args
+  );
+}
+
+// Conditions are true when they are a nonzero number, as in the compiler.
+void Folder::visit(const Conditional &conditional) {
+  conditional.expression()->accept(*this);
+  auto number = std::dynamic_pointer_cast<Number>(child_);
+  if(!number) {
+    TreeCloner::visit(conditional);
+    return;
+  }
+  auto branch = number->value() != 0 ?
+    conditional.true_block() :
+    conditional.false_block();
+  branch->expression()->accept(*this);
+}
+
+void Folder::visit(const Operation &operation) {
+  operation.left()->accept(*this);
+  auto left = child_;
+  operation.right()->accept(*this);
+  auto right = child_;
+
+  auto l = std::dynamic_pointer_cast<Number>(left);
+  auto r = std::dynamic_pointer_cast<Number>(right);
+  if(l && r) {
+    switch(operation.operation()) {
+    case Addition:
+      child_ = std::make_shared<Number>(l->value() + r->value());
+      return;
+    case Subtraction:
+      child_ = std::make_shared<Number>(l->value() - r->value());
+      return;
+    case Division:
+      child_ = std::make_shared<Number>(l->value() / r->value());
+      return;
+    case Multiplication:
+      child_ = std::make_shared<Number>(l->value() * r->value());
+      return;
+    }
+  }
+
+  auto ls = std::dynamic_pointer_cast<String>(left);
+  auto rs = std::dynamic_pointer_cast<String>(right);
+  if(ls && rs && operation.operation() == Addition) {
+    child_ = std::make_shared<String>(ls->value() + rs->value());
+    return;
+  }
+
+  // Identities that hold for every double, negative zero included. Adding
+  // zero isn't one of them. The operation is what says the operand kept is
+  // a number, so it only goes when something else says so too.
+  auto op = operation.operation();
+  if(r && numeric(left) &&
+     (op == Multiplication || op == Division) && r->value() == 1) {
+    child_ = left;
+    return;
+  }
+  if(r && numeric(left) &&
+     op == Subtraction && r->value() == 0 && !std::signbit(r->value())) {
+    child_ = left;
+    return;
+  }
+  if(l && numeric(right) && op == Multiplication && l->value() == 1) {
+    child_ = right;
+    return;
+  }
+
+  child_ = std::make_shared<Operation>(left, right, op, operation.type());
+}
+
+void Folder::visit(const Declaration &declaration) {
+  declaration.value()->accept(*this);
+  auto value = child_;
+  if(literal(value)) {
+    constants_[declaration.identifier()->internal_value()] = value;
+    declaration.expression()->accept(*this);
+    return;
+  }
+
+  declaration.identifier()->accept(*this);
+  auto ident = std::static_pointer_cast<Identifier>(child_);
+  declaration.expression()->accept(*this);
+  child_ = std::make_shared<Declaration>(ident, value, child_);
+}
@@ -0,0 +1,37 @@
+#ifndef SRC_FOLDER_
+#define SRC_FOLDER_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "node.hh"
+#include "visitor.hh"
+
+namespace goat {
+namespace folding {
+
+// Evaluates what it can before inference sees the tree: operations on
+// literals, identifiers bound to literals and conditionals whose condition
+// is a literal. Declarations of literals go away once every use has been
+// replaced. Runs after the renamer, so internal names are unique and a
+// substitution can't be captured.
+class Folder : public node::TreeCloner {
+ public:
+  Folder() :
+    TreeCloner(),
+    constants_() {}
+  void visit(const node::Identifier &identifier);
+  void visit(const node::Application &application);
+  void visit(const node::Conditional &conditional);
+  void visit(const node::Operation &operation);
+  void visit(const node::Declaration &declaration);
+  std::shared_ptr<node::Program> fold(std::shared_ptr<node::Program> program);
+ private:
+  std::map<std::string, std::shared_ptr<node::Node>> constants_;
+};
+
+}
+}
+
+#endif
@@ -1,5 +1,90 @@
 #include "freevars.hh"
 #include "node.hh"
 
+using namespace goat;
 using namespace goat::node;
 using namespace goat::lifter;
+
+void FreeVars::analyse(const Program &program) {
+  frames_.push_back({ids_.size(), util::Bitset()});
+  program.accept(*this);
+  frames_.pop_back();
+}
+
+size_t FreeVars::id(const std::string &name) {
+  auto id = ids_.find(name);
+  if(id != ids_.end()) {
+    return id->second;
+  }
+  ids_[name] = names_.size();
+  names_.push_back(std::make_shared<Identifier>(name, name));
+  return names_.size() - 1;
+}
+
+size_t FreeVars::bind(const Identifier &identifier) {
+  auto i = id(identifier.internal_value());
+  names_[i] = std::make_shared<Identifier>(identifier);
+  return i;
+}
+
+std::shared_ptr<IdentifierList>
+FreeVars::free(const Function &function, const util::Bitset &bound) const {
+  auto free = std::make_shared<IdentifierList>();
+  auto f = free_.find(&function);
+  if(f == free_.end()) {
+    return free;
+  }
+  auto vars = f->second;
+  vars.subtract(bound);
+  vars.each([&](size_t i) { free->push_back(names_[i]); });
+  return free;
+}
+
+void FreeVars::visit(const Identifier &identifier) {
+  auto name = identifier.internal_value();
+  if(ids_.find(name) == ids_.end()) {
+    // Used without ever being bound, so it is free everywhere.
+    external_.set(bind(identifier));
+  }
+  frames_.back().uses.set(ids_[name]);
+}
+
+void FreeVars::visit(const Argument &argument) {
+  argument.expression()->accept(*this);
+}
+
+void FreeVars::visit(const Function &function) {
+  frames_.push_back({ids_.size(), util::Bitset()});
+  for(auto a : *function.arguments()) {
+    bind(*a->identifier());
+  }
+  for(auto a : *function.arguments()) {
+    a->accept(*this);
+  }
+  function.program()->accept(*this);
+
+  auto frame = frames_.back();
+  frames_.pop_back();
+  auto free = frame.uses;
+  free.truncate(frame.start);
+  auto external = frame.uses;
+  external &= external_;
+  free |= external;
+  free_[&function] = free;
+  frames_.back().uses |= free;
+}
+
+void FreeVars::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  if(loop.counter() != nullptr) {
+    bind(*loop.counter()->identifier());
+    loop.counter()->accept(*this);
+  }
+  loop.program()->accept(*this);
+}
+
+void FreeVars::visit(const Declaration &declaration) {
+  bind(*declaration.identifier());
+  declaration.value()->accept(*this);
+  declaration.expression()->accept(*this);
+}
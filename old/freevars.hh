@@ -1,17 +1,54 @@
 #ifndef SRC_FREEVARS_
 #define SRC_FREEVARS_
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "node.hh"
+#include "util.hh"
 #include "visitor.hh"
-#include <set>
 
 namespace goat {
 namespace lifter {
+// Computes the free variables of every function in a renamed program in a
+// single bottom up pass.
+//
+// Each name gets a dense id the first time it is seen. Renamed binders are
+// unique and always seen before their uses, so everything a function binds
+// has an id at or above the first id handed out inside it, and its free
+// variables are just the ids it uses below that mark. The results are kept
+// per Function node.
 class FreeVars : public node::Visitor {
 public:
-  FreeVars(std::set<std::string> scope) : scope_(scope) {}
-  VisitorMethods
+  FreeVars() :
+    ids_(),
+    names_(),
+    external_(),
+    frames_(),
+    free_() {}
+  void visit(const node::Identifier &identifier);
+  void visit(const node::Argument &argument);
+  void visit(const node::Function &function);
+  void visit(const node::Loop &loop);
+  void visit(const node::Declaration &declaration);
+  void analyse(const node::Program &program);
+  size_t id(const std::string &name);
+  // The free variables of an analysed function, less those in `bound`, in
+  // id order.
+  std::shared_ptr<node::IdentifierList> free(const node::Function &function,
+                                             const util::Bitset &bound) const;
 private:
-  std::set<std::string> scope_;
+  struct Frame {
+    size_t start;
+    util::Bitset uses;
+  };
+  size_t bind(const node::Identifier &identifier);
+  std::unordered_map<std::string, size_t> ids_;
+  std::vector<std::shared_ptr<node::Identifier>> names_;
+  util::Bitset external_;
+  std::vector<Frame> frames_;
+  std::unordered_map<const node::Function *, util::Bitset> free_;
 };
 }
 }
@@ -0,0 +1,57 @@
+// goat socket run|bitcode|compile file
+// goat socket open name file
+// goat socket edit name offset length file
+// goat socket close name
+//
+// Sends a file to a goatd server, writing the result to stdout or the
+// error to stderr. Open, edit and close keep a document on the server,
+// where an edit replaces `length` bytes at `offset` with the file.
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "protocol.hh"
+
+using namespace goat;
+
+int main(int argc, char **argv) {
+  std::string command = argc > 2 ? argv[2] : "";
+  int arguments = command == "open" ? 5 : command == "edit" ? 7 : 4;
+  if(argc != arguments) {
+    std::cerr << "usage: goat socket run|bitcode|compile file\n"
+                 "       goat socket open name file\n"
+                 "       goat socket edit name offset length file\n"
+                 "       goat socket close name\n";
+    return 2;
+  }
+  std::string header;
+  for(int i = 3; i < argc - (command != "close"); i++) {
+    header += (i > 3 ? " " : "") + std::string(argv[i]);
+  }
+  std::string body = header.empty() ? "" : header + "\n";
+  if(command != "close") {
+    std::ifstream file(argv[argc - 1], std::ios::binary);
+    if(!file) {
+      std::cerr << argv[argc - 1] << ": couldn't open the file\n";
+      return 1;
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+    body += source.str();
+  }
+  auto reply = serving::request(argv[1], {command, body});
+  if(!reply) {
+    std::cerr << argv[1] << ": no reply from the server\n";
+    return 1;
+  }
+  if(reply->command != "ok") {
+    std::cerr << argv[argc - 1] << ": " << reply->body << "\n";
+    return 1;
+  }
+  std::cout << reply->body;
+  if(command == "run" || command == "open" || command == "edit") {
+    std::cout << "\n";
+  }
+  return 0;
+}
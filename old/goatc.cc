@@ -0,0 +1,133 @@
+// goatc [-j threads] [-C cache] [-c] [-O level] [-p partitions] [-B]
+//       [-s cost] [--interface in]... [--emit-interface out] [-o out]
+//       file...
+//
+// Compiles every file into one bitcode module, reporting throughput on
+// stderr. Files already in the cache directory aren't compiled again.
+// With -c it goes on to native code: an object file, or with more than one
+// partition an archive of one object per partition. -B always branches
+// on conditionals, -s sets what their branches may cost to use a select.
+//
+// --interface brings the declarations of an interface into scope, and
+// --emit-interface writes one with the top level declarations of the
+// files. Either only type checks, since imports have no code to link.
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "backend.hh"
+#include "cache.hh"
+#include "compiler.hh"
+#include "driver.hh"
+#include "pool.hh"
+
+using namespace goat;
+
+int main(int argc, char **argv) {
+  size_t threads = std::thread::hardware_concurrency();
+  std::string output;
+  std::optional<caching::Cache> cache;
+  bool native = false;
+  backend::Options options;
+  compiling::Compiler::Options compiler;
+  std::vector<std::string> paths;
+  serialising::Interface imports;
+  std::string interface;
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if(arg == "-j" && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if(arg == "-C" && i + 1 < argc) {
+      cache.emplace(argv[++i], uint64_t(256) << 20);
+    } else if(arg == "-c") {
+      native = true;
+    } else if(arg == "-O" && i + 1 < argc) {
+      options.level = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "-p" && i + 1 < argc) {
+      options.partitions = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "--interface" && i + 1 < argc) {
+      std::string error;
+      if(!driver::import(argv[++i], imports, error)) {
+        std::cerr << argv[i] << ": " << error << "\n";
+        return 1;
+      }
+    } else if(arg == "--emit-interface" && i + 1 < argc) {
+      interface = argv[++i];
+    } else if(arg == "-B") {
+      compiler.select = false;
+    } else if(arg == "-s" && i + 1 < argc) {
+      compiler.select_cost = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if(paths.empty()) {
+    std::cerr << "usage: goatc [-j threads] [-C cache] [-c] [-O level] "
+                 "[-p partitions] [-B] [-s cost] [--interface in]... "
+                 "[--emit-interface out] [-o out] file...\n";
+    return 2;
+  }
+  if(output.empty()) {
+    output = !native ? "goat.bc" : options.partitions > 1 ? "goat.a" : "goat.o";
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  util::Pool pool(threads);
+  if(!interface.empty() || !imports.empty()) {
+    std::vector<driver::Report> reports;
+    serialising::Interface exports;
+    bool ok = driver::interface(paths, pool, imports, reports, exports);
+    if(ok && !interface.empty()) {
+      std::ofstream out(interface, std::ios::binary);
+      out << serialising::write(exports);
+      if(!out) {
+        std::cerr << interface << ": couldn't write the interface\n";
+        ok = false;
+      }
+    }
+    driver::report(std::cerr, reports,
+                   std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start).count());
+    return ok ? 0 : 1;
+  }
+  llvm::LLVMContext context;
+  std::vector<driver::Report> reports;
+  auto module = driver::compile(paths, pool, context, reports,
+                                cache ? &*cache : nullptr, compiler);
+  bool ok = module != nullptr;
+  if(ok) {
+    std::error_code error;
+    llvm::raw_fd_ostream out(output, error, llvm::sys::fs::OF_None);
+    if(error) {
+      std::cerr << output << ": " << error.message() << "\n";
+      return 1;
+    }
+    if(!native) {
+      llvm::WriteBitcodeToFile(*module, out);
+    } else {
+      std::string message;
+      auto object = backend::emit(*module, pool, options, message);
+      if(object != nullptr) {
+        out << object->getBuffer();
+      } else {
+        std::cerr << output << ": " << message << "\n";
+        ok = false;
+      }
+    }
+  }
+  driver::report(std::cerr, reports,
+                 std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count());
+  return ok ? 0 : 1;
+}
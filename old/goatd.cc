@@ -0,0 +1,65 @@
+// goatd [-j threads] [-C cache] [-O level] [-p partitions] socket
+//
+// Serves compile and run requests on a Unix domain socket until it gets
+// SIGINT or SIGTERM. See protocol.hh, and goat for a client.
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+
+#include "backend.hh"
+#include "cache.hh"
+#include "pool.hh"
+#include "server.hh"
+
+using namespace goat;
+
+int main(int argc, char **argv) {
+  size_t threads = std::thread::hardware_concurrency();
+  std::optional<caching::Cache> cache;
+  backend::Options options;
+  std::string path;
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if(arg == "-j" && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "-C" && i + 1 < argc) {
+      cache.emplace(argv[++i], uint64_t(256) << 20);
+    } else if(arg == "-O" && i + 1 < argc) {
+      options.level = std::strtoul(argv[++i], nullptr, 10);
+    } else if(arg == "-p" && i + 1 < argc) {
+      options.partitions = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      path = arg;
+    }
+  }
+  if(path.empty()) {
+    std::cerr << "usage: goatd [-j threads] [-C cache] [-O level] "
+                 "[-p partitions] socket\n";
+    return 2;
+  }
+
+  // Signals go to a thread that waits for them, where it's safe to stop.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  util::Pool pool(threads);
+  serving::Server server(path, pool, cache ? &*cache : nullptr, options);
+  std::thread([&]() {
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+  }).detach();
+  if(!server.serve()) {
+    std::cerr << path << ": couldn't listen\n";
+    return 1;
+  }
+  return 0;
+}
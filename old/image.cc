@@ -0,0 +1,582 @@
+#include <cstring>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.hh"
+#include "static_visitor.hh"
+
+using namespace goat;
+using namespace goat::node;
+using namespace goat::inference;
+using namespace goat::serialising;
+
+namespace {
+const char magic[8] = {'g', 'o', 'a', 't', 'i', 'm', 'g', '1'};
+
+class Writer {
+ public:
+  Writer(const std::set<Substitution> &substitutions) :
+    substitutions_(substitutions),
+    nodes_(),
+    children_(),
+    symbols_(),
+    interned_(),
+    strings_(),
+    types_(),
+    type_ids_(),
+    type_children_(),
+    exports_() {
+    type(NoType());
+  }
+
+  uint32_t symbol(const std::string &s) {
+    auto found = interned_.find(s);
+    if(found != interned_.end()) return found->second;
+    uint32_t index = symbols_.size();
+    symbols_.push_back({uint32_t(strings_.size()), uint32_t(s.size())});
+    strings_ += s;
+    interned_.insert({s, index});
+    return index;
+  }
+
+  uint32_t type(const Type &t) {
+    auto found = type_ids_.find(t);
+    if(found != type_ids_.end()) return found->second;
+    TypeRecord record = {TypeTag::None, {}, 0, 0, none};
+    if(std::holds_alternative<NumberType>(t)) {
+      record.tag = TypeTag::Number;
+    } else if(std::holds_alternative<StringType>(t)) {
+      record.tag = TypeTag::String;
+    } else if(std::holds_alternative<BoolType>(t)) {
+      record.tag = TypeTag::Bool;
+    } else if(std::holds_alternative<TypeVariable>(t)) {
+      record.tag = TypeTag::Variable;
+      record.a = symbol(std::get<TypeVariable>(t).id());
+    } else if(std::holds_alternative<FunctionType>(t)) {
+      std::vector<uint32_t> types;
+      for(auto &p : std::get<FunctionType>(t).types()) {
+        types.push_back(type(p));
+      }
+      record.tag = TypeTag::Function;
+      record.a = run(type_children_, types);
+      record.b = types.size();
+    } else if(std::holds_alternative<RecordType>(t)) {
+      auto &r = std::get<RecordType>(t);
+      std::vector<uint32_t> fields;
+      for(size_t i = 0; i < r.labels().size(); i++) {
+        fields.push_back(symbol(r.labels()[i]));
+        fields.push_back(type(r.types()[i]));
+      }
+      record.tag = TypeTag::Record;
+      record.a = run(type_children_, fields);
+      record.b = r.labels().size();
+      if(r.tail()) record.c = symbol(r.tail()->id());
+    }
+    uint32_t index = types_.size();
+    types_.push_back(record);
+    type_ids_.insert({t, index});
+    return index;
+  }
+
+  uint32_t add(const Node &n) {
+    NodeRecord record = {n.kind(), 0, 0, 0, none, none, none, none};
+    dispatch(n, [&](auto &node) { fill(node, record); });
+    uint32_t index = nodes_.size();
+    nodes_.push_back(record);
+    return index;
+  }
+
+  void add_export(const std::string &name, const Type &t) {
+    exports_.push_back({symbol(name), type(t)});
+  }
+
+  std::string finish(uint32_t root) const {
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.root = root;
+    header.reserved = 0;
+    std::string out(sizeof(Header), '\0');
+    header.nodes = section(out, nodes_);
+    header.children = section(out, children_);
+    header.symbols = section(out, symbols_);
+    header.strings = section(out, std::vector<char>(strings_.begin(),
+                                                    strings_.end()));
+    header.types = section(out, types_);
+    header.type_children = section(out, type_children_);
+    header.exports = section(out, exports_);
+    std::memcpy(&out[0], &header, sizeof(header));
+    return out;
+  }
+
+ private:
+  // Children are added before the run that lists them, so runs of one
+  // node's children never interleave with its descendants'.
+  static uint32_t run(std::vector<uint32_t> &table,
+                      const std::vector<uint32_t> &items) {
+    uint32_t start = table.size();
+    table.insert(table.end(), items.begin(), items.end());
+    return start;
+  }
+
+  template <typename T>
+  static Section section(std::string &out, const std::vector<T> &items) {
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+    Section s = {uint32_t(out.size()), uint32_t(items.size())};
+    out.append(reinterpret_cast<const char *>(items.data()),
+               items.size() * sizeof(T));
+    return s;
+  }
+
+  uint32_t typed(const Type &t) {
+    return type(resolve(substitutions_, t));
+  }
+
+  void fill(const EmptyExpression &, NodeRecord &) {}
+  void fill(const Number &number, NodeRecord &record) {
+    auto value = number.value();
+    uint32_t words[2];
+    std::memcpy(words, &value, sizeof(value));
+    record.a = words[0];
+    record.b = words[1];
+  }
+  void fill(const Identifier &identifier, NodeRecord &record) {
+    record.a = symbol(identifier.value());
+    record.b = symbol(identifier.internal_value());
+    record.type = typed(identifier.type());
+  }
+  void fill(const String &string, NodeRecord &record) {
+    record.a = symbol(string.value());
+  }
+  void fill(const Program &program, NodeRecord &record) {
+    record.a = add(*program.expression());
+  }
+  void fill(const Argument &argument, NodeRecord &record) {
+    record.a = add(*argument.identifier());
+    record.b = add(*argument.expression());
+  }
+  void fill(const Function &function, NodeRecord &record) {
+    std::vector<uint32_t> children;
+    for(auto &a : *function.arguments()) children.push_back(add(*a));
+    for(auto &c : *function.captures()) children.push_back(add(*c));
+    record.a = run(children_, children);
+    record.b = function.arguments()->size();
+    record.c = function.captures()->size();
+    record.d = add(*function.program());
+    record.type = typed(function.type());
+  }
+  void fill(const Closure &closure, NodeRecord &record) {
+    std::vector<uint32_t> children;
+    for(auto &c : *closure.captures()) children.push_back(add(*c));
+    record.a = add(*closure.function());
+    record.b = run(children_, children);
+    record.c = children.size();
+    record.type = typed(closure.type());
+  }
+  void fill(const Label &label, NodeRecord &record) {
+    record.a = symbol(label.name());
+    record.b = add(*label.expression());
+  }
+  void fill(const Application &application, NodeRecord &record) {
+    std::vector<uint32_t> children;
+    for(auto &l : *application.labels()) children.push_back(add(*l.second));
+    record.a = add(*application.identifier());
+    record.b = run(children_, children);
+    record.c = children.size();
+    record.type = typed(application.function_type());
+  }
+  void fill(const Conditional &conditional, NodeRecord &record) {
+    record.a = add(*conditional.expression());
+    record.b = add(*conditional.true_block());
+    record.c = add(*conditional.false_block());
+  }
+  void fill(const Record &r, NodeRecord &record) {
+    std::vector<uint32_t> children;
+    for(auto &f : *r.fields()) children.push_back(add(*f));
+    record.a = run(children_, children);
+    record.b = children.size();
+    record.c = add(*r.base());
+    record.type = typed(r.type());
+  }
+  void fill(const Selection &selection, NodeRecord &record) {
+    record.a = add(*selection.record());
+    record.b = symbol(selection.label());
+    record.type = typed(selection.type());
+  }
+  void fill(const Loop &loop, NodeRecord &record) {
+    record.a = add(*loop.count());
+    if(loop.counter() != nullptr) record.b = add(*loop.counter());
+    record.c = add(*loop.program());
+  }
+  void fill(const Operation &operation, NodeRecord &record) {
+    record.a = add(*operation.left());
+    record.b = add(*operation.right());
+    record.operation = operation.operation();
+    record.type = typed(operation.type());
+  }
+  void fill(const Declaration &declaration, NodeRecord &record) {
+    record.a = add(*declaration.identifier());
+    record.b = add(*declaration.value());
+    record.c = add(*declaration.expression());
+  }
+
+  const std::set<Substitution> &substitutions_;
+  std::vector<NodeRecord> nodes_;
+  std::vector<uint32_t> children_;
+  std::vector<Symbol> symbols_;
+  std::map<std::string, uint32_t> interned_;
+  std::string strings_;
+  std::vector<TypeRecord> types_;
+  std::map<Type, uint32_t> type_ids_;
+  std::vector<uint32_t> type_children_;
+  std::vector<Export> exports_;
+};
+
+template <typename T>
+bool fits(const Section &section, size_t size) {
+  return section.offset % alignof(T) == 0 &&
+    section.offset <= size &&
+    section.count <= (size - section.offset) / sizeof(T);
+}
+}
+
+Interface serialising::exports(const Program &program,
+                               const std::set<Substitution> &substitutions) {
+  Interface interface;
+  auto expression = program.expression();
+  while(expression->kind() == Kind::Declaration) {
+    auto &declaration = static_cast<const Declaration &>(*expression);
+    interface.push_back({declaration.identifier()->value(),
+                         resolve(substitutions,
+                                 declaration.identifier()->type())});
+    expression = declaration.expression();
+  }
+  return interface;
+}
+
+std::string serialising::write(const Program &program,
+                               const std::set<Substitution> &substitutions) {
+  Writer writer(substitutions);
+  auto root = writer.add(program);
+  for(auto &e : exports(program, substitutions)) {
+    writer.add_export(e.first, e.second);
+  }
+  return writer.finish(root);
+}
+
+std::string serialising::write(const Interface &interface) {
+  std::set<Substitution> substitutions;
+  Writer writer(substitutions);
+  for(auto &e : interface) {
+    writer.add_export(e.first, e.second);
+  }
+  return writer.finish(none);
+}
+
+std::optional<Image> Image::view(const char *data, size_t size) {
+  if(size < sizeof(Header) ||
+     reinterpret_cast<uintptr_t>(data) % alignof(Header) != 0 ||
+     std::memcmp(data, magic, sizeof(magic)) != 0) {
+    return std::nullopt;
+  }
+  Image image(data, size);
+  auto &h = image.header();
+  if(!fits<NodeRecord>(h.nodes, size) ||
+     !fits<uint32_t>(h.children, size) ||
+     !fits<Symbol>(h.symbols, size) ||
+     !fits<char>(h.strings, size) ||
+     !fits<TypeRecord>(h.types, size) ||
+     !fits<uint32_t>(h.type_children, size) ||
+     !fits<Export>(h.exports, size) ||
+     !image.valid()) {
+    return std::nullopt;
+  }
+  return image;
+}
+
+bool Image::valid() const {
+  auto &h = header();
+  auto symbols = table<Symbol>(h.symbols);
+  for(uint32_t i = 0; i < h.symbols.count; i++) {
+    if(uint64_t(symbols[i].offset) + symbols[i].length > h.strings.count) {
+      return false;
+    }
+  }
+  for(uint32_t i = 0; i < h.types.count; i++) {
+    if(!valid_type(i)) return false;
+  }
+  for(uint32_t i = 0; i < h.nodes.count; i++) {
+    if(!valid_node(i)) return false;
+  }
+  auto exports = table<Export>(h.exports);
+  for(uint32_t i = 0; i < h.exports.count; i++) {
+    if(exports[i].symbol >= h.symbols.count ||
+       exports[i].type >= h.types.count) {
+      return false;
+    }
+  }
+  return h.root == none ||
+    (h.root < h.nodes.count && node(h.root).kind == Kind::Program);
+}
+
+// A type's children are types before it.
+bool Image::valid_type(uint32_t index) const {
+  auto &h = header();
+  auto &record = table<TypeRecord>(h.types)[index];
+  auto children = table<uint32_t>(h.type_children);
+  auto run = [&](uint32_t count, uint32_t stride) {
+    return uint64_t(record.a) + uint64_t(count) * stride <=
+      h.type_children.count;
+  };
+  switch(record.tag) {
+  case TypeTag::None:
+  case TypeTag::Number:
+  case TypeTag::String:
+  case TypeTag::Bool:
+    return true;
+  case TypeTag::Variable:
+    return record.a < h.symbols.count;
+  case TypeTag::Function:
+    if(record.b == 0 || !run(record.b, 1)) return false;
+    for(uint32_t i = 0; i < record.b; i++) {
+      if(children[record.a + i] >= index) return false;
+    }
+    return true;
+  case TypeTag::Record:
+    if(!run(record.b, 2)) return false;
+    for(uint32_t i = 0; i < record.b; i++) {
+      if(children[record.a + 2 * i] >= h.symbols.count ||
+         children[record.a + 2 * i + 1] >= index) {
+        return false;
+      }
+    }
+    return record.c == none || record.c < h.symbols.count;
+  }
+  return false;
+}
+
+// A node's children are nodes before it, of the kinds build expects.
+bool Image::valid_node(uint32_t index) const {
+  auto &h = header();
+  auto &r = node(index);
+  auto is = [&](uint32_t child, std::optional<Kind> kind = std::nullopt) {
+    return child < index && (!kind || node(child).kind == *kind);
+  };
+  auto run = [&](uint32_t first, uint32_t count, Kind kind) {
+    if(uint64_t(first) + count > h.children.count) return false;
+    for(uint32_t i = 0; i < count; i++) {
+      if(!is(child(first + i), kind)) return false;
+    }
+    return true;
+  };
+  auto symbol = [&](uint32_t s) { return s < h.symbols.count; };
+  if(r.type >= h.types.count) {
+    return false;
+  }
+  switch(r.kind) {
+  case Kind::EmptyExpression:
+  case Kind::Number:
+    return true;
+  case Kind::Identifier:
+    return symbol(r.a) && symbol(r.b);
+  case Kind::String:
+    return symbol(r.a);
+  case Kind::Program:
+    return is(r.a);
+  case Kind::Argument:
+    return is(r.a, Kind::Identifier) && is(r.b);
+  case Kind::Function:
+    return uint64_t(r.b) + r.c <= h.children.count &&
+      run(r.a, r.b, Kind::Argument) &&
+      run(r.a + r.b, r.c, Kind::Identifier) &&
+      is(r.d, Kind::Program);
+  case Kind::Closure:
+    return is(r.a, Kind::Identifier) && run(r.b, r.c, Kind::Identifier);
+  case Kind::Label:
+    return symbol(r.a) && is(r.b);
+  case Kind::Application:
+    return is(r.a, Kind::Identifier) && run(r.b, r.c, Kind::Label);
+  case Kind::Conditional:
+    return is(r.a) && is(r.b, Kind::Program) && is(r.c, Kind::Program);
+  case Kind::Record:
+    return run(r.a, r.b, Kind::Label) && is(r.c);
+  case Kind::Selection:
+    return is(r.a) && symbol(r.b);
+  case Kind::Loop:
+    return is(r.a) && (r.b == none || is(r.b, Kind::Argument)) &&
+      is(r.c, Kind::Program);
+  case Kind::Operation:
+    return is(r.a) && is(r.b) && r.operation <= Multiplication;
+  case Kind::Declaration:
+    return is(r.a, Kind::Identifier) && is(r.b) && is(r.c);
+  }
+  return false;
+}
+
+double Image::number(const NodeRecord &record) const {
+  uint32_t words[2] = {record.a, record.b};
+  double value;
+  std::memcpy(&value, words, sizeof(value));
+  return value;
+}
+
+Type Image::type(uint32_t index) const {
+  auto &record = table<TypeRecord>(header().types)[index];
+  auto children = table<uint32_t>(header().type_children);
+  switch(record.tag) {
+  case TypeTag::None:
+    return NoType();
+  case TypeTag::Number:
+    return NumberType();
+  case TypeTag::String:
+    return StringType();
+  case TypeTag::Bool:
+    return BoolType();
+  case TypeTag::Variable:
+    return TypeVariable(std::string(symbol(record.a)));
+  case TypeTag::Function: {
+    std::vector<Type> types;
+    for(uint32_t i = 0; i < record.b; i++) {
+      types.push_back(type(children[record.a + i]));
+    }
+    return FunctionType(types);
+  }
+  case TypeTag::Record: {
+    std::vector<std::string> labels;
+    std::vector<Type> types;
+    for(uint32_t i = 0; i < record.b; i++) {
+      labels.push_back(std::string(symbol(children[record.a + 2 * i])));
+      types.push_back(type(children[record.a + 2 * i + 1]));
+    }
+    if(record.c != none) {
+      return RecordType(labels, types,
+                        TypeVariable(std::string(symbol(record.c))));
+    }
+    return RecordType(labels, types);
+  }
+  }
+  return NoType();
+}
+
+Interface Image::interface() const {
+  Interface interface;
+  auto exports = table<Export>(header().exports);
+  for(uint32_t i = 0; i < header().exports.count; i++) {
+    interface.push_back({std::string(symbol(exports[i].symbol)),
+                         type(exports[i].type)});
+  }
+  return interface;
+}
+
+std::shared_ptr<Program> Image::program() const {
+  if(root() == none) {
+    return nullptr;
+  }
+  return build<Program>(root());
+}
+
+std::shared_ptr<Node> Image::build(uint32_t index) const {
+  auto &r = node(index);
+  switch(r.kind) {
+  case Kind::EmptyExpression:
+    return std::make_shared<EmptyExpression>();
+  case Kind::Number:
+    return std::make_shared<Number>(number(r));
+  case Kind::Identifier:
+    return std::make_shared<Identifier>(std::string(symbol(r.a)),
+                                        std::string(symbol(r.b)),
+                                        type(r.type));
+  case Kind::String:
+    return std::make_shared<String>(std::string(symbol(r.a)));
+  case Kind::Program:
+    return std::make_shared<Program>(build(r.a));
+  case Kind::Argument:
+    return std::make_shared<Argument>(build<Identifier>(r.a),
+                                      build(r.b));
+  case Kind::Function: {
+    auto args = std::make_shared<ArgumentList>();
+    auto captures = std::make_shared<IdentifierList>();
+    for(uint32_t i = 0; i < r.b; i++) {
+      args->push_back(build<Argument>(child(r.a + i)));
+    }
+    for(uint32_t i = 0; i < r.c; i++) {
+      captures->push_back(build<Identifier>(child(r.a + r.b + i)));
+    }
+    return std::make_shared<Function>(args, build<Program>(r.d),
+                                      type(r.type), captures);
+  }
+  case Kind::Closure: {
+    auto captures = std::make_shared<IdentifierList>();
+    for(uint32_t i = 0; i < r.c; i++) {
+      captures->push_back(build<Identifier>(child(r.b + i)));
+    }
+    return std::make_shared<Closure>(build<Identifier>(r.a),
+                                     captures, type(r.type));
+  }
+  case Kind::Label:
+    return std::make_shared<Label>(std::string(symbol(r.a)), build(r.b));
+  case Kind::Application: {
+    auto labels = std::make_shared<Labels>();
+    for(uint32_t i = 0; i < r.c; i++) {
+      auto label = build<Label>(child(r.b + i));
+      labels->insert({label->name(), label});
+    }
+    return std::make_shared<Application>(build<Identifier>(r.a),
+                                         labels, type(r.type));
+  }
+  case Kind::Conditional:
+    return std::make_shared<Conditional>(build(r.a),
+                                         build<Program>(r.b),
+                                         build<Program>(r.c));
+  case Kind::Record: {
+    auto fields = std::make_shared<Fields>();
+    for(uint32_t i = 0; i < r.b; i++) {
+      fields->push_back(build<Label>(child(r.a + i)));
+    }
+    return std::make_shared<Record>(fields, build(r.c), type(r.type));
+  }
+  case Kind::Selection:
+    return std::make_shared<Selection>(build(r.a), std::string(symbol(r.b)),
+                                       type(r.type));
+  case Kind::Loop:
+    if(r.b == none) {
+      return std::make_shared<Loop>(build(r.a), build<Program>(r.c));
+    }
+    return std::make_shared<Loop>(build(r.a), build<Argument>(r.b),
+                                  build<Program>(r.c));
+  case Kind::Operation:
+    return std::make_shared<Operation>(build(r.a), build(r.b),
+                                       static_cast<Ops>(r.operation),
+                                       type(r.type));
+  case Kind::Declaration:
+    return std::make_shared<Declaration>(build<Identifier>(r.a),
+                                         build(r.b), build(r.c));
+  }
+  return std::make_shared<EmptyExpression>();
+}
+
+std::unique_ptr<Mapping> Mapping::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::unique_ptr<Mapping>(
+    new Mapping(static_cast<const char *>(data), st.st_size));
+}
+
+Mapping::~Mapping() {
+  munmap(const_cast<char *>(data_), size_);
+}
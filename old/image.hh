@@ -0,0 +1,189 @@
+#ifndef SRC_IMAGE_
+#define SRC_IMAGE_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "inferer.hh"
+#include "node.hh"
+
+namespace goat {
+namespace serialising {
+
+// A renamed, typed program as flat tables that can be mapped from disk and
+// read where they lie. Everything refers to everything else by index, so an
+// image means the same wherever it is mapped. Numbers are in host byte
+// order.
+//
+// Nodes are fixed size records, children that come in lists (arguments,
+// captures, labels, fields) are runs in a separate table of node indices.
+// Strings are interned into a symbol table and types into a type table, so
+// every repeated name or type is stored once.
+//
+// The exports are the principal types of the top level declarations. An
+// image with exports and no nodes is an interface: enough to type check
+// code using the program without inferring the program again.
+const uint32_t none = UINT32_MAX;
+
+struct Section {
+  uint32_t offset;
+  uint32_t count;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t root;
+  uint32_t reserved;
+  Section nodes;
+  Section children;
+  Section symbols;
+  Section strings;
+  Section types;
+  Section type_children;
+  Section exports;
+};
+
+// Fields by kind, `type` being an index in the type table:
+//   Number       a and b hold the double
+//   Identifier   a value symbol, b internal symbol, type
+//   String       a symbol
+//   Program      a expression
+//   Argument     a identifier, b expression
+//   Function     a first child, b arguments, c captures, d program, type
+//   Closure      a function, b first child, c captures, type
+//   Label        a name symbol, b expression
+//   Application  a identifier, b first child, c labels, type of the callee
+//   Conditional  a expression, b true block, c false block
+//   Record       a first child, b fields, c base, type
+//   Selection    a record, b label symbol, type
+//   Loop         a count, b counter or none, c program
+//   Operation    a left, b right, operation, type
+//   Declaration  a identifier, b value, c expression
+struct NodeRecord {
+  node::Kind kind;
+  uint8_t operation;
+  uint16_t reserved;
+  uint32_t type;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t d;
+};
+
+struct Symbol {
+  uint32_t offset;
+  uint32_t length;
+};
+
+enum class TypeTag : uint8_t {
+  None,
+  Number,
+  String,
+  Bool,
+  Variable,
+  Function,
+  Record
+};
+
+// Variables have their name symbol in a. Functions have a run of b types in
+// the type children from a, the result last. Records have b fields from a
+// as label symbol and type pairs, and c the tail's symbol or none.
+struct TypeRecord {
+  TypeTag tag;
+  uint8_t reserved[3];
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+};
+
+struct Export {
+  uint32_t symbol;
+  uint32_t type;
+};
+
+using Interface = std::vector<std::pair<std::string, inference::Type>>;
+
+// The principal types of a program's top level declarations, by source name.
+Interface exports(const node::Program &program,
+                  const std::set<inference::Substitution> &substitutions);
+
+// An image of a program typed by the substitutions.
+std::string write(const node::Program &program,
+                  const std::set<inference::Substitution> &substitutions);
+// An image with just the interface.
+std::string write(const Interface &interface);
+
+// Reads an image in place. The bytes have to outlive it.
+class Image {
+ public:
+  // Null if the data isn't an image, a table runs off the end or a record
+  // refers to anything that isn't there. Children always come before their
+  // parents, so that also rules out cycles.
+  static std::optional<Image> view(const char *data, size_t size);
+  uint32_t root() const { return header().root; }
+  const NodeRecord &node(uint32_t index) const {
+    return table<NodeRecord>(header().nodes)[index];
+  }
+  uint32_t child(uint32_t index) const {
+    return table<uint32_t>(header().children)[index];
+  }
+  std::string_view symbol(uint32_t index) const {
+    auto &s = table<Symbol>(header().symbols)[index];
+    return std::string_view(data_ + header().strings.offset + s.offset,
+                            s.length);
+  }
+  double number(const NodeRecord &record) const;
+  inference::Type type(uint32_t index) const;
+  Interface interface() const;
+  // Builds the tree again, for passes that want nodes.
+  std::shared_ptr<node::Program> program() const;
+ private:
+  Image(const char *data, size_t size) :
+    data_(data),
+    size_(size) {}
+  const Header &header() const {
+    return *reinterpret_cast<const Header *>(data_);
+  }
+  template <typename T>
+  const T *table(const Section &section) const {
+    return reinterpret_cast<const T *>(data_ + section.offset);
+  }
+  bool valid() const;
+  bool valid_node(uint32_t index) const;
+  bool valid_type(uint32_t index) const;
+  std::shared_ptr<node::Node> build(uint32_t index) const;
+  template <typename T>
+  std::shared_ptr<T> build(uint32_t index) const {
+    return std::static_pointer_cast<T>(build(index));
+  }
+  const char *data_;
+  size_t size_;
+};
+
+// A file mapped read only, unmapped when this goes.
+class Mapping {
+ public:
+  static std::unique_ptr<Mapping> open(const std::string &path);
+  ~Mapping();
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+ private:
+  Mapping(const char *data, size_t size) :
+    data_(data),
+    size_(size) {}
+  const char *data_;
+  size_t size_;
+};
+
+}
+}
+
+#endif
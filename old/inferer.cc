@@ -1,6 +1,9 @@
 #include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <type_traits>
 #include <variant>
@@ -15,12 +18,124 @@ using namespace goat;
 using namespace goat::inference;
 using namespace goat::node;
 
+namespace {
+// Whether an expression refers to any of the given names.
+class Mentions : public node::Visitor {
+ public:
+  Mentions(std::set<std::string> names) :
+    names_(names),
+    found_(false) {}
+  void visit(const Identifier &identifier) {
+    found_ = found_ || names_.count(identifier.internal_value()) > 0;
+  }
+  bool found() const { return found_; }
+ private:
+  std::set<std::string> names_;
+  bool found_;
+};
+
+// The names an expression uses that it doesn't bind itself.
+class Free : public node::Visitor {
+ public:
+  void visit(const Identifier &identifier) {
+    used_.insert(identifier.internal_value());
+  }
+  void visit(const Argument &argument) {
+    bound_.insert(argument.identifier()->internal_value());
+    if(argument.expression() != nullptr) {
+      argument.expression()->accept(*this);
+    }
+  }
+  void visit(const Declaration &declaration) {
+    bound_.insert(declaration.identifier()->internal_value());
+    declaration.value()->accept(*this);
+    declaration.expression()->accept(*this);
+  }
+  std::set<std::string> names() const {
+    std::set<std::string> names;
+    std::set_difference(used_.begin(), used_.end(),
+                        bound_.begin(), bound_.end(),
+                        std::inserter(names, names.end()));
+    return names;
+  }
+ private:
+  std::set<std::string> used_;
+  std::set<std::string> bound_;
+};
+
+Type freshen(const Type &type,
+            std::map<std::string, Type> &fresh,
+            util::Namer &namer) {
+  if(std::holds_alternative<TypeVariable>(type)) {
+    auto id = std::get<TypeVariable>(type).id();
+    if(fresh.count(id) == 0) {
+      fresh.insert({id, TypeVariable(namer.next())});
+    }
+    return fresh.at(id);
+  }
+  if(std::holds_alternative<FunctionType>(type)) {
+    std::vector<Type> types;
+    for(auto &t : std::get<FunctionType>(type).types()) {
+      types.push_back(freshen(t, fresh, namer));
+    }
+    return FunctionType(types);
+  }
+  if(std::holds_alternative<RecordType>(type)) {
+    auto &record = std::get<RecordType>(type);
+    std::vector<Type> types;
+    for(auto &t : record.types()) {
+      types.push_back(freshen(t, fresh, namer));
+    }
+    if(record.tail()) {
+      return RecordType(record.labels(), types,
+                        std::get<TypeVariable>(
+                          freshen(*record.tail(), fresh, namer)));
+    }
+    return RecordType(record.labels(), types);
+  }
+  return type;
+}
+
+ArgumentList positional(const ArgumentList &arguments) {
+  auto sorted = arguments;
+  std::stable_sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+    return a->identifier()->value() < b->identifier()->value();
+  });
+  return sorted;
+}
+}
+
+// Exported types are principal, so they are schemes like our own generic
+// functions.
+void Inferer::assume(const std::string &internal, const Type &type) {
+  schemes_[internal] = type;
+}
+
 std::shared_ptr<node::Program> Inferer::infer(std::shared_ptr<node::Program> program) {
   return clone(program);
 }
 
 void Inferer::visit(const Identifier &identifier) {
-  Expects(scope_.find(identifier.internal_value()) != scope_.end());
+  // Each use of a generic function gets a copy of its type of its own.
+  auto scheme = schemes_.find(identifier.internal_value());
+  if(scheme != schemes_.end()) {
+    std::map<std::string, Type> fresh;
+    auto var = TypeVariable(namer_.next());
+    constraints_.insert(Constraint({
+      var,
+      freshen(scheme->second, fresh, namer_)
+    }));
+    child_ = std::make_shared<node::Identifier>(
+      identifier.value(),
+      identifier.internal_value(),
+      var
+    );
+    return;
+  }
+  if(scope_.find(identifier.internal_value()) == scope_.end()) {
+    errors_.push_back("unbound name " + identifier.value());
+    scope_[identifier.internal_value()] = TypeVariable(namer_.next());
+  }
   auto type = scope_.find(identifier.internal_value())->second;
   Expects(std::holds_alternative<TypeVariable>(type));
   child_ = std::make_shared<node::Identifier>(
@@ -50,7 +165,7 @@ void Inferer::visit(const Argument &argument) {
 void Inferer::visit(const Function &function) {
   auto args = std::make_shared<ArgumentList>();
   auto types = std::vector<Type>();
-  for(auto argument : *function.arguments()) {
+  for(auto argument : positional(*function.arguments())) {
     auto var = argument->identifier()->internal_value();
     scope_[var] = TypeVariable(namer_.next());
     types.push_back(scope_[var]);
@@ -75,8 +190,36 @@ void Inferer::visit(const Application &application) {
   auto args = std::make_shared<Labels>();
   application.identifier()->accept(*this);
   auto ident = std::static_pointer_cast<Identifier>(child_);
+
+  auto labels = *application.labels();
+  auto signature = signatures_.find(ident->internal_value());
+  if(signature != signatures_.end()) {
+    for(auto a : *signature->second) {
+      auto name = a->identifier()->value();
+      if(labels.find(name) != labels.end()) {
+        continue;
+      }
+      if(*a->expression() == EmptyExpression()) {
+        errors_.push_back("missing argument " + name + " to " +
+                          ident->value());
+        continue;
+      }
+      labels.insert({name, std::make_shared<Label>(name, a->expression())});
+    }
+    // Every label has to name a parameter.
+    for(auto &l : labels) {
+      auto named = std::any_of(
+        signature->second->begin(), signature->second->end(),
+        [&](auto &a) { return a->identifier()->value() == l.first; });
+      if(!named) {
+        errors_.push_back(ident->value() + " has no parameter " + l.first);
+      }
+    }
+  }
+
+  // Labels are kept sorted by name, which is the parameter order.
   auto types = std::vector<Type>();
-  for(auto l : *application.labels()) {
+  for(auto l : labels) {
     l.second->accept(*this);
     auto arg = std::static_pointer_cast<Label>(child_);
     auto type = arg->type();
@@ -96,50 +239,160 @@ void Inferer::visit(const Application &application) {
 }
 
 void Inferer::visit(const Conditional &conditional) {
+  conditional.expression()->accept(*this);
+  auto expr = child_;
+  conditional.true_block()->accept(*this);
+  auto true_block = std::static_pointer_cast<Program>(child_);
+  conditional.false_block()->accept(*this);
+  auto false_block = std::static_pointer_cast<Program>(child_);
+
+  // Nothing makes a bool yet, conditions are numbers and true unless zero.
   constraints_.insert(Constraint({
-    conditional.true_type(),
-    conditional.false_type()
+    expr->type(),
+    NumberType()
   }));
+  // Without an else there's nothing for the true block to agree with.
+  if(*conditional.false_block()->expression() != EmptyExpression()) {
+    constraints_.insert(Constraint({
+      true_block->type(),
+      false_block->type()
+    }));
+  }
+
+  child_ = std::make_shared<Conditional>(expr, true_block, false_block);
+}
 
+void Inferer::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = child_;
   constraints_.insert(Constraint({
-    conditional.expression()->type(),
-    BoolType()
+    count->type(),
+    NumberType()
   }));
 
-  conditional.expression()->accept(*this);
-  auto expr = child_;
-  conditional.true_block()->accept(*this);
-  auto true_block = child_;
-  conditional.false_block()->accept(*this);
-  auto false_block = child_;
+  std::shared_ptr<Argument> counter;
+  if(loop.counter() != nullptr) {
+    auto var = loop.counter()->identifier()->internal_value();
+    scope_[var] = TypeVariable(namer_.next());
+    constraints_.insert(Constraint({
+      scope_[var],
+      NumberType()
+    }));
+    loop.counter()->accept(*this);
+    counter = std::static_pointer_cast<Argument>(child_);
+  }
 
-  child_ = std::make_shared<Conditional>(
-    expr,
-    std::static_pointer_cast<Program>(true_block),
-    std::static_pointer_cast<Program>(false_block)
-  );
+  loop.program()->accept(*this);
+  auto program = std::static_pointer_cast<Program>(child_);
+  if(counter) {
+    child_ = std::make_shared<Loop>(count, counter, program);
+  } else {
+    child_ = std::make_shared<Loop>(count, program);
+  }
 }
 
-void Inferer::visit(const Operation &operation) {
-  operation.left()->accept(*this);
-  auto left = child_;
+void Inferer::visit(const Record &record) {
+  auto fields = std::make_shared<Fields>();
+  std::vector<std::string> labels;
+  std::vector<Type> types;
+  for(auto f : *record.fields()) {
+    f->accept(*this);
+    auto field = std::static_pointer_cast<Label>(child_);
+    fields->push_back(field);
+    labels.push_back(field->name());
+    types.push_back(field->type());
+  }
+
+  record.base()->accept(*this);
+  auto base = child_;
+  if(*base == EmptyExpression()) {
+    child_ = std::make_shared<Record>(fields, base, RecordType(labels, types));
+    return;
+  }
+  // Extending a record puts the new fields in front of whatever it had.
+  TypeVariable rest(namer_.next());
   constraints_.insert(Constraint({
-    left->type(),
-    NumberType()
+    base->type(),
+    RecordType({}, {}, rest)
   }));
+  child_ = std::make_shared<Record>(fields,
+                                    base,
+                                    RecordType(labels, types, rest));
+}
 
-  operation.right()->accept(*this);
-  auto right = child_;
+void Inferer::visit(const Selection &selection) {
+  selection.record()->accept(*this);
+  auto record = child_;
+  Type field = TypeVariable(namer_.next());
   constraints_.insert(Constraint({
-    right->type(),
-    NumberType()
+    record->type(),
+    RecordType({selection.label()}, {field}, TypeVariable(namer_.next()))
   }));
+  child_ = std::make_shared<Selection>(record, selection.label(), field);
+}
 
-  child_ = std::make_shared<Operation>(left, right, operation.operation());
+void Inferer::visit(const Operation &operation) {
+  operation.left()->accept(*this);
+  auto left = child_;
+  operation.right()->accept(*this);
+  auto right = child_;
+
+  // Addition works on numbers and strings alike, which one is settled by
+  // the compiler once the operands have a concrete type. solve() checks
+  // it's one of the two.
+  Type type = NumberType();
+  if(operation.operation() == Addition) {
+    type = TypeVariable(namer_.next());
+    additions_.push_back(type);
+  }
+  constraints_.insert(Constraint({left->type(), type}));
+  constraints_.insert(Constraint({right->type(), type}));
+
+  child_ = std::make_shared<Operation>(left,
+                                       right,
+                                       operation.operation(),
+                                       type);
 }
 
+// A function is generalised when everything it uses besides itself is
+// generic too. It then has no free type variables, so its type is solved
+// from its own constraints and every variable left in it can be renamed
+// apart at each use. Functions using anything else stay monomorphic, like
+// every other value, which also keeps generic code from capturing
+// anything.
 void Inferer::visit(const Declaration &declaration) {
-  scope_[declaration.identifier()->internal_value()] = TypeVariable(namer_.next());
+  auto name = declaration.identifier()->internal_value();
+  auto function = std::dynamic_pointer_cast<Function>(declaration.value());
+  bool generic = false;
+  if(function) {
+    // Defaults are copied to call sites, where the parameters don't exist.
+    std::set<std::string> params;
+    for(auto a : *function->arguments()) {
+      params.insert(a->identifier()->internal_value());
+    }
+    for(auto a : *function->arguments()) {
+      Mentions mentions(params);
+      a->expression()->accept(mentions);
+      if(mentions.found()) {
+        errors_.push_back("the default of " + a->identifier()->value() +
+                          " refers to a parameter");
+      }
+    }
+    signatures_[name] = function->arguments();
+
+    Free free;
+    function->accept(free);
+    auto names = free.names();
+    generic = std::all_of(names.begin(), names.end(), [&](auto &n) {
+      return n == name || schemes_.find(n) != schemes_.end();
+    });
+  }
+
+  std::set<Constraint> outer;
+  if(generic) {
+    outer.swap(constraints_);
+  }
+  scope_[name] = TypeVariable(namer_.next());
   declaration.identifier()->accept(*this);
   auto ident = child_;
   declaration.value()->accept(*this);
@@ -150,6 +403,18 @@ void Inferer::visit(const Declaration &declaration) {
     value->type()
   }));
 
+  if(generic) {
+    auto solved = Constraint::unify(constraints_);
+    auto failed = std::any_of(solved.begin(), solved.end(), [](auto s) {
+      return s.is_error();
+    });
+    // The error turns up again when the whole program is solved.
+    if(!failed) {
+      schemes_[name] = resolve(solved, value->type());
+    }
+    constraints_.insert(outer.begin(), outer.end());
+  }
+
   declaration.expression()->accept(*this);
   auto expr = child_;
 
@@ -166,11 +431,77 @@ Constraint Constraint::apply(Substitution s) const {
   return Constraint({left, right});
 }
 
+RecordType::RecordType(std::vector<std::string> labels,
+                       std::vector<Type> types) :
+  labels_(labels),
+  types_(types),
+  tail_() {
+  normalise();
+}
+
+RecordType::RecordType(std::vector<std::string> labels,
+                       std::vector<Type> types,
+                       TypeVariable tail) :
+  labels_(labels),
+  types_(types),
+  tail_(tail) {
+  normalise();
+}
+
+bool RecordType::equals(const AbstractType &b) const {
+  auto c = *static_cast<const RecordType *>(&b);
+  return labels_ == c.labels_ && types_ == c.types_ && tail_ == c.tail_;
+}
+
+bool RecordType::less(const AbstractType &b) const {
+  auto c = *static_cast<const RecordType *>(&b);
+  return std::tie(labels_, types_, tail_) <
+    std::tie(c.labels_, c.types_, c.tail_);
+}
+
+// Stable, so duplicate labels stay in scope order.
+void RecordType::normalise() {
+  std::vector<size_t> order(labels_.size());
+  for(size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return labels_[a] < labels_[b];
+  });
+  std::vector<std::string> labels;
+  std::vector<Type> types;
+  for(auto i : order) {
+    labels.push_back(labels_[i]);
+    types.push_back(types_[i]);
+  }
+  labels_ = labels;
+  types_ = types;
+}
+
+std::optional<size_t> RecordType::find(const std::string &label) const {
+  auto l = std::lower_bound(labels_.begin(), labels_.end(), label);
+  if(l == labels_.end() || *l != label) {
+    return std::nullopt;
+  }
+  return l - labels_.begin();
+}
+
+RecordType RecordType::extend(const RecordType &rest) const {
+  auto labels = labels_;
+  auto types = types_;
+  labels.insert(labels.end(), rest.labels_.begin(), rest.labels_.end());
+  types.insert(types.end(), rest.types_.begin(), rest.types_.end());
+  if(rest.tail_) {
+    return RecordType(labels, types, *rest.tail_);
+  }
+  return RecordType(labels, types);
+}
+
 bool TypeVariable::occurs(Type in) const {
   return std::visit([this](auto&& arg) {
       using T = std::decay_t<decltype(arg)>;
       if constexpr (std::is_same_v<T, TypeVariable>) {
-        return *this = arg;
+        return *this == arg;
       } else if constexpr (
         std::is_same_v<T, NumberType>
         || std::is_same_v<T, StringType>
@@ -184,6 +515,12 @@ bool TypeVariable::occurs(Type in) const {
             accum = accum || this->occurs(v);
           }
           return accum;
+      } else if constexpr (std::is_same_v<T, RecordType>) {
+        bool accum = arg.tail() && *this == *arg.tail();
+        for(auto v : arg.types()) {
+          accum = accum || this->occurs(v);
+        }
+        return accum;
       } else {
         return false;
       }
@@ -197,20 +534,37 @@ Type Substitution::operator()(Type in) const {
     std::vector<Type> args;
     auto fn = std::get<FunctionType>(in);
     for(auto v : fn.types()) {
-      if(Type(s_) != v) {
-        args.push_back(v);
-      } else {
-        args.push_back(Substitution(s_, t_)(v));
-      }
+      args.push_back((*this)(v));
     }
 
     return FunctionType(args);
+  } else if(std::holds_alternative<RecordType>(in)) {
+    std::vector<Type> fields;
+    auto record = std::get<RecordType>(in);
+    for(auto v : record.types()) {
+      fields.push_back((*this)(v));
+    }
+    auto row = RecordType(record.labels(), fields);
+    if(!record.tail()) {
+      return row;
+    }
+    // Filling in the rest of an open row.
+    if(Type(*record.tail()) == s_) {
+      if(std::holds_alternative<RecordType>(t_)) {
+        return row.extend(std::get<RecordType>(t_));
+      }
+      if(std::holds_alternative<TypeVariable>(t_)) {
+        return RecordType(row.labels(), row.types(), std::get<TypeVariable>(t_));
+      }
+    }
+    return RecordType(row.labels(), row.types(), *record.tail());
   } else {
     return in;
   }
 }
 
 std::set<Substitution> Constraint::unify(std::set<Constraint> constraints) {
+  static util::Namer rows;
   auto c = constraints.begin();
   if(c == constraints.end())
     return {};
@@ -223,13 +577,14 @@ std::set<Substitution> Constraint::unify(std::set<Constraint> constraints) {
   if(t == tq)
     return unify(constraints);
 
-  if(std::holds_altertive<TypeVariable>(tq)) {
+  if(std::holds_alternative<TypeVariable>(tq) &&
+     !std::holds_alternative<TypeVariable>(t)) {
     constraints.insert(Constraint({tq, t}));
     return unify(constraints);
   }
 
-  if(std::hold_alternative<TypeVariable>(t)) {
-    if(!t.get<TypeVariable>().occurs(tq)) {
+  if(std::holds_alternative<TypeVariable>(t)) {
+    if(!std::get<TypeVariable>(t).occurs(tq)) {
       auto subs = Substitution(t, tq);
       std::set<Constraint> consts;
       for (auto c : constraints) {
@@ -256,6 +611,57 @@ std::set<Substitution> Constraint::unify(std::set<Constraint> constraints) {
     return unify(constraints);
   }
 
+  // Rows are merged like sorted lists: fields with the same label pair up
+  // in scope order and whatever one side lacks has to come out of the other
+  // side's tail.
+  if(std::holds_alternative<RecordType>(t) && std::holds_alternative<RecordType>(tq)) {
+    auto r = std::get<RecordType>(t);
+    auto rq = std::get<RecordType>(tq);
+    std::vector<std::string> only, only_q;
+    std::vector<Type> only_types, only_q_types;
+    size_t i = 0, j = 0;
+    while(i < r.labels().size() || j < rq.labels().size()) {
+      if(j == rq.labels().size() ||
+         (i < r.labels().size() && r.labels()[i] < rq.labels()[j])) {
+        only.push_back(r.labels()[i]);
+        only_types.push_back(r.types()[i++]);
+      } else if(i == r.labels().size() || rq.labels()[j] < r.labels()[i]) {
+        only_q.push_back(rq.labels()[j]);
+        only_q_types.push_back(rq.types()[j++]);
+      } else {
+        constraints.insert(Constraint({r.types()[i++], rq.types()[j++]}));
+      }
+    }
+
+    auto tail = r.tail();
+    auto tail_q = rq.tail();
+    if(only.empty() && only_q.empty()) {
+      if(tail && tail_q) {
+        constraints.insert(Constraint({*tail, *tail_q}));
+      } else if(tail) {
+        constraints.insert(Constraint({*tail, RecordType({}, {})}));
+      } else if(tail_q) {
+        constraints.insert(Constraint({*tail_q, RecordType({}, {})}));
+      }
+      return unify(constraints);
+    }
+    // A closed row can't grow, and a row can't be its own extension.
+    if((!only_q.empty() && !tail) || (!only.empty() && !tail_q) ||
+       (tail && tail_q && *tail == *tail_q)) {
+      return {Substitution::error()};
+    }
+    if(tail && tail_q) {
+      TypeVariable rest("row." + rows.next());
+      constraints.insert(Constraint({*tail, RecordType(only_q, only_q_types, rest)}));
+      constraints.insert(Constraint({*tail_q, RecordType(only, only_types, rest)}));
+    } else if(tail) {
+      constraints.insert(Constraint({*tail, RecordType(only_q, only_q_types)}));
+    } else {
+      constraints.insert(Constraint({*tail_q, RecordType(only, only_types)}));
+    }
+    return unify(constraints);
+  }
+
   std::cout << "Error!" << std::endl;
   return {Substitution::error()};
 }
@@ -266,7 +672,18 @@ std::set<TypeVariable> freevars(Type in) {
   } else if(std::holds_alternative<FunctionType>(in)){
     std::set<TypeVariable> ret;
     for(auto t : std::get<FunctionType>(in).types()) {
-      auto vars = freevars(in);
+      auto vars = freevars(t);
+      ret.insert(vars.begin(), vars.end());
+    }
+    return ret;
+  } else if(std::holds_alternative<RecordType>(in)){
+    auto record = std::get<RecordType>(in);
+    std::set<TypeVariable> ret;
+    if(record.tail()) {
+      ret.insert(*record.tail());
+    }
+    for(auto t : record.types()) {
+      auto vars = freevars(t);
       ret.insert(vars.begin(), vars.end());
     }
     return ret;
@@ -284,6 +701,57 @@ std::set<TypeVariable> Constraint::activevars() const {
   return ret;
 }
 
+Type inference::resolve(const std::set<Substitution> &substitutions, Type type) {
+  for(auto last = Type(NoType()); type != last;) {
+    last = type;
+    for(auto &s : substitutions) {
+      type = s(type);
+    }
+  }
+  return type;
+}
+
 std::set<Substitution> Inferer::solve() {
-  return Constraint::unify(constraints_);
+  auto solved = Constraint::unify(constraints_);
+  for(auto &addition : additions_) {
+    auto type = resolve(solved, addition);
+    if(!std::holds_alternative<NumberType>(type) &&
+       !std::holds_alternative<StringType>(type) &&
+       !std::holds_alternative<TypeVariable>(type)) {
+      std::ostringstream message;
+      message << "can't add " << type;
+      errors_.push_back(message.str());
+    }
+  }
+  if(!errors_.empty()) {
+    solved.insert(Substitution::error());
+  }
+  return solved;
+}
+
+std::ostream &inference::operator<<(std::ostream &out, const Type &type) {
+  if(std::holds_alternative<NumberType>(type)) return out << "number";
+  if(std::holds_alternative<StringType>(type)) return out << "string";
+  if(std::holds_alternative<BoolType>(type)) return out << "bool";
+  if(std::holds_alternative<NoType>(type)) return out << "()";
+  if(std::holds_alternative<TypeVariable>(type)) {
+    return out << std::get<TypeVariable>(type).id();
+  }
+  if(std::holds_alternative<FunctionType>(type)) {
+    auto &types = std::get<FunctionType>(type).types();
+    out << "(";
+    for(size_t i = 0; i + 1 < types.size(); i++) {
+      out << (i ? ", " : "") << types[i];
+    }
+    return out << ") -> " << types.back();
+  }
+  auto &record = std::get<RecordType>(type);
+  out << "{";
+  for(size_t i = 0; i < record.labels().size(); i++) {
+    out << (i ? ", " : "") << record.labels()[i] << ": " << record.types()[i];
+  }
+  if(record.tail()) {
+    out << (record.labels().empty() ? "" : " ") << "| " << record.tail()->id();
+  }
+  return out << "}";
 }
@@ -6,9 +6,11 @@
 #include <set>
 #include <string>
 #include <iostream>
+#include <optional>
 #include <typeinfo>
 #include <unordered_map>
 #include <utility>
+#include <tuple>
 #include <variant>
 #include <vector>
 #include "util.hh"
@@ -41,13 +43,15 @@ class StringType : public AbstractType {};
 class BoolType : public AbstractType {};
 class NoType : public AbstractType {};
 class FunctionType;
+class RecordType;
 class TypeVariable;
 using Type = std::variant<NoType,
                           TypeVariable,
                           NumberType,
                           StringType,
                           BoolType,
-                          FunctionType>;
+                          FunctionType,
+                          RecordType>;
 
 class TypeVariable : public AbstractType {
  public:
@@ -67,6 +71,35 @@ class TypeVariable : public AbstractType {
   std::string id_;
 };
 
+// A row of labelled fields, with scoped labels: a label may appear more than
+// once and the first occurrence is the one in scope. Fields are kept sorted
+// by label, keeping duplicates in scope order, so rows unify with a merge
+// and a label's position is fixed once the row is closed. An open row ends
+// in a type variable standing for the rest of the fields.
+class RecordType : public AbstractType {
+ public:
+  RecordType(std::vector<std::string> labels,
+             std::vector<Type> types);
+  RecordType(std::vector<std::string> labels,
+             std::vector<Type> types,
+             TypeVariable tail);
+  const std::vector<std::string>& labels() const { return labels_; }
+  const std::vector<Type>& types() const { return types_; }
+  const std::optional<TypeVariable>& tail() const { return tail_; }
+  // Where the field in scope for a label is.
+  std::optional<size_t> find(const std::string &label) const;
+  // This row with another appended to the end, in place of the tail.
+  RecordType extend(const RecordType &rest) const;
+ private:
+  // Out of line, FunctionType isn't complete yet.
+  bool equals(const AbstractType &b) const;
+  bool less(const AbstractType &b) const;
+  void normalise();
+  std::vector<std::string> labels_;
+  std::vector<Type> types_;
+  std::optional<TypeVariable> tail_;
+};
+
 class FunctionType : public AbstractType {
  public:
   FunctionType(std::vector<Type> types) :
@@ -85,6 +118,10 @@ class FunctionType : public AbstractType {
   std::vector<Type> types_;
 };
 
+// Types as they would be written: number, (number, string) -> bool,
+// {x: number | row.a}.
+std::ostream &operator<<(std::ostream &out, const Type &type);
+
 class Substitution {
 public:
   Substitution(Type s, Type t) :
@@ -102,7 +139,7 @@ public:
   }
 
   bool operator<(const Substitution &b) const {
-    return s_ < b.s_ || t_ < b.t_;
+    return std::tie(s_, t_) < std::tie(b.s_, b.t_);
   }
 
   Type operator()(Type in) const;
@@ -142,26 +179,61 @@ class Constraint {
   std::pair<Type, Type> variables_;
 };
 
-
+// A type with every variable the substitutions solve replaced by its
+// solution, the solutions' own variables included.
+Type resolve(const std::set<Substitution> &substitutions, Type type);
+
+// Functions take their parameters in the order of their label names, so
+// a call site resolves every label to a fixed position without knowing
+// the callee. Calls to functions known by name also get any labels they
+// leave out filled in from the parameter defaults.
+//
+// A function that uses nothing but other generic functions is generic
+// itself, and each use of it gets a fresh copy of its type.
 class Inferer : public node::TreeCloner {
  public:
   Inferer() :
     constraints_(),
-    namer_() {}
+    namer_(),
+    scope_(),
+    signatures_(),
+    schemes_(),
+    additions_(),
+    errors_() {}
   void visit(const node::Identifier &identifier);
   void visit(const node::Argument &argument);
   void visit(const node::Function &function);
   void visit(const node::Application &application);
   void visit(const node::Conditional &conditional);
+  void visit(const node::Loop &loop);
+  void visit(const node::Record &record);
+  void visit(const node::Selection &selection);
   void visit(const node::Declaration &declaration);
   void visit(const node::Operation &operation);
+  // Types an identifier bound outside the program, say by an interface
+  // of another one. Each use gets the type's variables renamed apart from
+  // ours and from every other use.
+  void assume(const std::string &internal, const Type &type);
   std::shared_ptr<node::Program> infer(std::shared_ptr<node::Program> program);
   const std::set<Constraint>& constraints() const { return constraints_; }
+  // Solves the constraints, with an error in the solution if they didn't
+  // unify or the program misused a name or a label.
   std::set<Substitution> solve();
+  // What the program got wrong besides its types not unifying.
+  const std::vector<std::string>& errors() const { return errors_; }
  private:
   std::set<Constraint> constraints_;
   util::Namer namer_;
   std::unordered_map<std::string, Type> scope_;
+  std::unordered_map<
+    std::string,
+    std::shared_ptr<std::vector<std::shared_ptr<node::Argument>>>
+  > signatures_;
+  // The types of generic functions, renamed apart at each use.
+  std::unordered_map<std::string, Type> schemes_;
+  // The types of every +, each a number or a string.
+  std::vector<Type> additions_;
+  std::vector<std::string> errors_;
 };
 
 }  // namespace inference
@@ -0,0 +1,174 @@
+#include "inliner.hh"
+
+using namespace goat;
+using namespace node;
+using namespace inlining;
+
+namespace {
+// Counts the nodes in an expression.
+class Size : public Visitor {
+ public:
+  Size() : size_(0) {}
+  void visit(const Identifier &identifier) { size_++; }
+  void visit(const Number &number) { size_++; }
+  void visit(const String &string) { size_++; }
+  void visit(const Function &function) { size_++; Visitor::visit(function); }
+  void visit(const Application &application) {
+    size_++;
+    Visitor::visit(application);
+  }
+  void visit(const Conditional &conditional) {
+    size_++;
+    Visitor::visit(conditional);
+  }
+  void visit(const Loop &loop) { size_++; Visitor::visit(loop); }
+  void visit(const Record &record) { size_++; Visitor::visit(record); }
+  void visit(const Selection &selection) {
+    size_++;
+    Visitor::visit(selection);
+  }
+  void visit(const Operation &operation) {
+    size_++;
+    Visitor::visit(operation);
+  }
+  void visit(const Declaration &declaration) {
+    size_++;
+    Visitor::visit(declaration);
+  }
+  size_t size() const { return size_; }
+ private:
+  size_t size_;
+};
+
+// Whether an expression refers to a name.
+class Mentions : public Visitor {
+ public:
+  Mentions(std::string name) :
+    name_(name),
+    found_(false) {}
+  void visit(const Identifier &identifier) {
+    found_ = found_ || identifier.internal_value() == name_;
+  }
+  bool found() const { return found_; }
+ private:
+  std::string name_;
+  bool found_;
+};
+
+// Copies an expression, giving each name it binds a new internal name.
+// Names are unique so one map covers every scope.
+class Refresher : public TreeCloner {
+ public:
+  Refresher(util::Namer &namer) :
+    TreeCloner(),
+    namer_(namer),
+    names_() {}
+  std::shared_ptr<Identifier> bind(const Identifier &identifier) {
+    auto fresh = "inline." + namer_.next();
+    names_[identifier.internal_value()] = fresh;
+    return std::make_shared<Identifier>(identifier.value(), fresh);
+  }
+  std::shared_ptr<Node> refresh(const Node &node) {
+    node.accept(*this);
+    return child_;
+  }
+  void visit(const Identifier &identifier) {
+    auto name = names_.find(identifier.internal_value());
+    if(name == names_.end()) {
+      TreeCloner::visit(identifier);
+      return;
+    }
+    child_ = std::make_shared<Identifier>(identifier.value(), name->second);
+  }
+  void visit(const Argument &argument) {
+    bind(*argument.identifier());
+    TreeCloner::visit(argument);
+  }
+  void visit(const Declaration &declaration) {
+    bind(*declaration.identifier());
+    TreeCloner::visit(declaration);
+  }
+ private:
+  util::Namer &namer_;
+  std::map<std::string, std::string> names_;
+};
+}
+
+std::shared_ptr<Program> Inliner::inline_calls(std::shared_ptr<Program> program) {
+  return clone(program);
+}
+
+void Inliner::visit(const Application &application) {
+  TreeCloner::visit(application);
+  auto candidate = functions_.find(
+    application.identifier()->internal_value());
+  if(candidate == functions_.end()) {
+    return;
+  }
+  statistics_.calls++;
+  if(candidate->second.verdict == TooBig) {
+    statistics_.too_big++;
+    return;
+  }
+  if(candidate->second.verdict == Recursive) {
+    statistics_.recursive++;
+    return;
+  }
+
+  // Every parameter needs a value and every label a parameter, otherwise
+  // the call is left for inference to complain about.
+  auto call = std::static_pointer_cast<Application>(child_);
+  auto &function = *candidate->second.function;
+  std::vector<std::shared_ptr<Node>> values;
+  size_t used = 0;
+  for(auto a : *function.arguments()) {
+    auto label = call->labels()->find(a->identifier()->value());
+    if(label != call->labels()->end()) {
+      values.push_back(label->second->expression());
+      used++;
+    } else if(*a->expression() != EmptyExpression()) {
+      values.push_back(nullptr);
+    } else {
+      return;
+    }
+  }
+  if(used != call->labels()->size()) {
+    return;
+  }
+
+  Refresher refresher(namer_);
+  std::vector<std::shared_ptr<Identifier>> params;
+  for(size_t i = 0; i < values.size(); i++) {
+    auto &argument = *(*function.arguments())[i];
+    params.push_back(refresher.bind(*argument.identifier()));
+    if(!values[i]) {
+      values[i] = refresher.refresh(*argument.expression());
+    }
+  }
+  auto body = refresher.refresh(*function.program()->expression());
+  for(size_t i = values.size(); i > 0; i--) {
+    body = std::make_shared<Declaration>(params[i - 1], values[i - 1], body);
+  }
+  statistics_.inlined++;
+  child_ = body;
+}
+
+void Inliner::visit(const Declaration &declaration) {
+  declaration.identifier()->accept(*this);
+  auto ident = std::static_pointer_cast<Identifier>(child_);
+  declaration.value()->accept(*this);
+  auto value = child_;
+  auto function = std::dynamic_pointer_cast<Function>(value);
+  if(function) {
+    // Calls in the body were inlined first, so this is the size it would be.
+    Size size;
+    function->program()->accept(size);
+    Mentions mentions(ident->internal_value());
+    function->accept(mentions);
+    auto verdict = mentions.found() ? Recursive :
+      size.size() > budget_ ? TooBig : Inline;
+    functions_[ident->internal_value()] = {function, verdict};
+  }
+  declaration.expression()->accept(*this);
+  child_ = std::make_shared<Declaration>(ident, value, child_);
+}
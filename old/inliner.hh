@@ -0,0 +1,57 @@
+#ifndef SRC_INLINER_
+#define SRC_INLINER_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "node.hh"
+#include "visitor.hh"
+#include "util.hh"
+
+namespace goat {
+namespace inlining {
+
+// Replaces calls to small functions declared by name with their bodies,
+// each parameter becoming a declaration bound to its argument or default.
+// Runs on the renamed tree before inference, and gives every binder in an
+// inlined copy a fresh internal name so names stay unique. Recursive
+// functions are never inlined, and since a function can only see names
+// declared around it there is no other way to recurse.
+class Inliner : public node::TreeCloner {
+ public:
+  struct Statistics {
+    size_t calls;
+    size_t inlined;
+    // Calls left alone because the callee was over budget or recursive.
+    size_t too_big;
+    size_t recursive;
+  };
+  // The budget is the most nodes a function body can have to be inlined.
+  Inliner(size_t budget = 24) :
+    TreeCloner(),
+    budget_(budget),
+    functions_(),
+    statistics_(),
+    namer_() {}
+  void visit(const node::Application &application);
+  void visit(const node::Declaration &declaration);
+  std::shared_ptr<node::Program> inline_calls(
+    std::shared_ptr<node::Program> program);
+  const Statistics &statistics() const { return statistics_; }
+ private:
+  enum Verdict { Inline, TooBig, Recursive };
+  struct Candidate {
+    std::shared_ptr<node::Function> function;
+    Verdict verdict;
+  };
+  size_t budget_;
+  std::map<std::string, Candidate> functions_;
+  Statistics statistics_;
+  util::Namer namer_;
+};
+
+}
+}
+
+#endif
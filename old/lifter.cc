@@ -4,5 +4,89 @@ using namespace goat::node;
 using namespace goat::lifter;
 
 std::shared_ptr<Program> Lifter::lift(std::shared_ptr<node::Program> program) {
-  return program;
+  free_.analyse(*program);
+  auto expression = clone(program)->expression();
+  // Inner functions were lifted first, so wrapping in reverse keeps every
+  // function in scope of the ones that refer to it.
+  for(auto l = lifted_.rbegin(); l != lifted_.rend(); l++) {
+    expression = std::make_shared<Declaration>(l->first, l->second, expression);
+  }
+  return std::make_shared<Program>(expression);
+}
+
+void Lifter::visit(const Function &function) {
+  auto name = binding_;
+  binding_ = nullptr;
+  if(!name) {
+    auto internal = "lambda." + namer_.next();
+    name = std::make_shared<Identifier>("lambda", internal, function.type());
+  }
+
+  TreeCloner::visit(function);
+  auto lifted = std::static_pointer_cast<Function>(child_);
+
+  // A recursive function reaches itself through its own environment.
+  auto id = free_.id(name->internal_value());
+  auto bound = globals_;
+  bound.set(id);
+  auto free = free_.free(function, bound);
+  auto captures = std::make_shared<IdentifierList>();
+  for(auto c : *free) {
+    auto rename = renames_.find(c->internal_value());
+    captures->push_back(rename == renames_.end() ? c : rename->second);
+  }
+
+  lifted_.push_back({name, std::make_shared<Function>(
+    lifted->arguments(),
+    lifted->program(),
+    lifted->type(),
+    captures
+  )});
+  if(captures->empty()) {
+    globals_.set(id);
+  }
+  child_ = std::make_shared<Closure>(name, captures, function.type());
+}
+
+void Lifter::visit(const Identifier &identifier) {
+  auto rename = renames_.find(identifier.internal_value());
+  if(rename == renames_.end()) {
+    TreeCloner::visit(identifier);
+    return;
+  }
+  child_ = std::make_shared<Identifier>(identifier.value(),
+                                        rename->second->internal_value(),
+                                        identifier.type());
+}
+
+void Lifter::visit(const Declaration &declaration) {
+  if(!std::dynamic_pointer_cast<Function>(declaration.value())) {
+    TreeCloner::visit(declaration);
+    return;
+  }
+  binding_ = declaration.identifier();
+  declaration.value()->accept(*this);
+  auto closure = std::static_pointer_cast<Closure>(child_);
+  // Nothing captured, the global is all there is.
+  if(closure->captures()->empty()) {
+    declaration.expression()->accept(*this);
+    return;
+  }
+
+  auto name = declaration.identifier()->internal_value();
+  auto identifier = std::make_shared<Identifier>(
+    declaration.identifier()->value(),
+    "closure." + namer_.next(),
+    declaration.identifier()->type()
+  );
+  auto outer = renames_.find(name) == renames_.end() ? nullptr
+                                                     : renames_[name];
+  renames_[name] = identifier;
+  declaration.expression()->accept(*this);
+  if(outer) {
+    renames_[name] = outer;
+  } else {
+    renames_.erase(name);
+  }
+  child_ = std::make_shared<Declaration>(identifier, closure, child_);
 }
@@ -1,22 +1,52 @@
 #ifndef SRC_LIFTER_
 #define SRC_LIFTER_
 
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "freevars.hh"
 #include "visitor.hh"
 #include "node.hh"
+#include "util.hh"
 
 namespace goat {
 namespace lifter {
 // Lifts closures to the global scope
+//
+// Every function is moved to the top of the program and replaced by a
+// Closure naming the lifted function and the variables it captures, which
+// become its flat environment. Functions that capture nothing are plain
+// globals and are referenced directly rather than captured.
+//
+// A named function keeps its name as a global, which is how it refers to
+// itself. If it captures anything the closure built where it was declared
+// is bound to a new name, and the rest of the scope refers to that.
 class Lifter : public node::TreeCloner {
 public:
   Lifter() :
-    names_(),
-    root_() {};
-  VisitorMethods
+    binding_(),
+    lifted_(),
+    globals_(),
+    renames_(),
+    free_(),
+    namer_() {};
+  void visit(const node::Identifier &identifier);
+  void visit(const node::Function &function);
+  void visit(const node::Declaration &declaration);
   std::shared_ptr<node::Program> lift(std::shared_ptr<node::Program> program);
 private:
-  std::unordered_map<std::string, std::string> names_;
-  std::shared_ptr<node::Program> root_;
+  using Lifted = std::pair<std::shared_ptr<node::Identifier>,
+                           std::shared_ptr<node::Function>>;
+  std::shared_ptr<node::Identifier> binding_;
+  std::vector<Lifted> lifted_;
+  util::Bitset globals_;
+  // Closure bindings in scope, by the name of the function they close.
+  std::map<std::string, std::shared_ptr<node::Identifier>> renames_;
+  FreeVars free_;
+  util::Namer namer_;
 };
 }
 }
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <algorithm>
 #include <vector>
 #include "node.hh"
@@ -19,9 +20,13 @@ accept(Identifier)
 accept(String)
 accept(Program)
 accept(Function)
+accept(Closure)
 accept(Label)
 accept(Application)
 accept(Conditional)
+accept(Loop)
+accept(Record)
+accept(Selection)
 accept(Operation)
 accept(Declaration)
 accept(Argument)
@@ -44,7 +49,11 @@ bool Identifier::equals(const Node &b) const {
 
 bool Number::equals(const Node &b) const {
   const Number *c = static_cast<const Number *>(&b);
-  return value_ == c->value_;
+  // Equal numbers have to be interchangeable, so zeros keep their sign.
+  if(std::isnan(value_) || std::isnan(c->value_)) {
+    return std::isnan(value_) && std::isnan(c->value_);
+  }
+  return value_ == c->value_ && std::signbit(value_) == std::signbit(c->value_);
 }
 
 bool Program::equals(const Node &b) const {
@@ -61,9 +70,16 @@ bool Argument::equals(const Node &b) const {
 bool Function::equals(const Node &b) const {
   const Function *c = static_cast<const Function *>(&b);
   return util::compare_vector_pointers(arguments_, c->arguments_) &&
+    util::compare_vector_pointers(captures_, c->captures_) &&
     *program_ == *c->program_;
 }
 
+bool Closure::equals(const Node &b) const {
+  const Closure *c = static_cast<const Closure *>(&b);
+  return *function_ == *c->function_ &&
+    util::compare_vector_pointers(captures_, c->captures_);
+}
+
 bool Label::equals(const Node &b) const {
   const Label *c = static_cast<const Label *>(&b);
   return name_ == c->name_ &&
@@ -90,6 +106,26 @@ bool Conditional::equals(const Node &b) const {
     *false_block_ == *c->false_block_;
 }
 
+bool Record::equals(const Node &b) const {
+  const Record *c = static_cast<const Record *>(&b);
+  return util::compare_vector_pointers(fields_, c->fields_) &&
+    *base_ == *c->base_;
+}
+
+bool Selection::equals(const Node &b) const {
+  const Selection *c = static_cast<const Selection *>(&b);
+  return label_ == c->label_ && *record_ == *c->record_;
+}
+
+bool Loop::equals(const Node &b) const {
+  const Loop *c = static_cast<const Loop *>(&b);
+  if((counter_ == nullptr) != (c->counter_ == nullptr))
+    return false;
+  return *count_ == *c->count_ &&
+    (counter_ == nullptr || *counter_ == *c->counter_) &&
+    *program_ == *c->program_;
+}
+
 bool Operation::equals(const Node &b) const {
   const Operation *c = static_cast<const Operation *>(&b);
   return *lhs_ == *c->lhs_ && *rhs_ == *c->rhs_ && op_ == c->op_;
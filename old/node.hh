@@ -14,13 +14,36 @@
 namespace goat {
 namespace node {
 
+// Which class a node is, so a traversal can switch on it instead of going
+// through accept. See StaticVisitor.
+enum class Kind : uint8_t {
+  EmptyExpression,
+  Number,
+  Identifier,
+  String,
+  Program,
+  Argument,
+  Function,
+  Closure,
+  Label,
+  Application,
+  Conditional,
+  Record,
+  Selection,
+  Loop,
+  Operation,
+  Declaration,
+};
+
 class Node {
  public:
+  Node(Kind kind) : kind_(kind) {}
   virtual ~Node() = default;
+  Kind kind() const { return kind_; }
   virtual void accept(class Visitor &v) const = 0;
   virtual const inference::Type type() const = 0;
   bool operator==(const Node &b) const {
-    if(typeid(*this) != typeid(b)) return false;
+    if(kind_ != b.kind_) return false;
     return equals(b);
   }
   bool operator!=(const Node &b) const {
@@ -28,6 +51,7 @@ class Node {
   }
  private:
   virtual bool equals(const Node &) const = 0;
+  const Kind kind_;
 };
 using NodeList = std::vector<std::shared_ptr<Node>>;
 
@@ -35,7 +59,7 @@ using NodeList = std::vector<std::shared_ptr<Node>>;
 // comparisons.
 class EmptyExpression : public Node {
  public:
-  EmptyExpression() {}
+  EmptyExpression() : Node(Kind::EmptyExpression) {}
   void accept(Visitor &v) const;
   const inference::Type type() const { return inference::NoType(); };
 private:
@@ -45,6 +69,7 @@ private:
 class Number : public Node {
  public:
   Number(const double value) :
+    Node(Kind::Number),
     value_(value),
     type_(inference::NumberType()) {}
   void accept(Visitor& v) const;
@@ -59,17 +84,20 @@ class Number : public Node {
 class Identifier : public Node {
  public:
   Identifier(const std::string name) :
+    Node(Kind::Identifier),
     value_(name),
     internal_value_(),
     type_(inference::NoType()) {}
   Identifier(const std::string name,
              const std::string internal_name) :
+    Node(Kind::Identifier),
     value_(name),
     internal_value_(internal_name),
     type_(inference::NoType()) {}
   Identifier(const std::string name,
              const std::string internal_name,
              inference::Type type) :
+    Node(Kind::Identifier),
     value_(name),
     internal_value_(internal_name),
     type_(type) {}
@@ -83,10 +111,12 @@ class Identifier : public Node {
   const std::string internal_value_;
   const inference::Type type_;
 };
+using IdentifierList = std::vector<std::shared_ptr<Identifier>>;
 
 class String : public Node {
  public:
   String(const std::string value) :
+    Node(Kind::String),
     value_(value),
     type_(inference::StringType()) {}
   void accept(Visitor& v) const;
@@ -101,11 +131,14 @@ class String : public Node {
 // For a block the type is the same as the last node on the list.
 class Program : public Node {
  public:
-  Program() : expression_(std::make_shared<EmptyExpression>()) {}
+  Program() :
+    Node(Kind::Program),
+    expression_(std::make_shared<EmptyExpression>()) {}
   Program(std::shared_ptr<Node> expression) :
+    Node(Kind::Program),
     expression_(expression) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Node> expression() const { return expression_; }
+  const std::shared_ptr<Node> &expression() const { return expression_; }
   const inference::Type type() const { return expression_->type(); }
  private:
   bool equals(const Node& b) const;
@@ -116,14 +149,16 @@ class Argument : public Node {
  public:
   Argument(const std::shared_ptr<Identifier> ident,
            const std::shared_ptr<Node> expression) :
+    Node(Kind::Argument),
     identifier_(ident),
     expression_(expression) {}
   Argument(const std::shared_ptr<Identifier> ident) :
+    Node(Kind::Argument),
     identifier_(ident),
     expression_(std::make_shared<EmptyExpression>()) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Identifier> identifier() const { return identifier_; }
-  const std::shared_ptr<Node> expression() const { return expression_; }
+  const std::shared_ptr<Identifier> &identifier() const { return identifier_; }
+  const std::shared_ptr<Node> &expression() const { return expression_; }
   const inference::Type type() const { return identifier_->type(); }
  private:
   bool equals(const Node& b) const;
@@ -136,24 +171,63 @@ class Function : public Node {
  public:
   Function(const std::shared_ptr<ArgumentList> arguments,
            const std::shared_ptr<Program> program) :
+    Node(Kind::Function),
     arguments_(arguments),
     program_(program),
+    captures_(std::make_shared<IdentifierList>()),
     type_(inference::NoType()) {}
   Function(const std::shared_ptr<ArgumentList> arguments,
            const std::shared_ptr<Program> program,
            inference::Type type) :
+    Node(Kind::Function),
+    arguments_(arguments),
+    program_(program),
+    captures_(std::make_shared<IdentifierList>()),
+    type_(type) {}
+  Function(const std::shared_ptr<ArgumentList> arguments,
+           const std::shared_ptr<Program> program,
+           inference::Type type,
+           const std::shared_ptr<IdentifierList> captures) :
+    Node(Kind::Function),
     arguments_(arguments),
     program_(program),
+    captures_(captures),
     type_(type) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<ArgumentList> arguments() const { return arguments_; }
-  const std::shared_ptr<Program> program() const { return program_; }
+  const std::shared_ptr<ArgumentList> &arguments() const { return arguments_; }
+  const std::shared_ptr<Program> &program() const { return program_; }
+  // Variables from enclosing scopes, in environment order. Only filled in
+  // once the lifter has closure converted the function.
+  const std::shared_ptr<IdentifierList> &captures() const { return captures_; }
   const std::string id() const;
   const inference::Type type() const { return type_; }
  private:
   bool equals(const Node &b) const;
   const std::shared_ptr<ArgumentList> arguments_;
   const std::shared_ptr<Program> program_;
+  const std::shared_ptr<IdentifierList> captures_;
+  inference::Type type_;
+};
+
+// A lifted function paired with the variables it captured, what a function
+// expression becomes after closure conversion.
+class Closure : public Node {
+ public:
+  Closure(std::shared_ptr<Identifier> function,
+          std::shared_ptr<IdentifierList> captures,
+          inference::Type type) :
+    Node(Kind::Closure),
+    function_(function),
+    captures_(captures),
+    type_(type) {}
+  void accept(Visitor& v) const;
+  const std::shared_ptr<Identifier> &function() const { return function_; }
+  const std::shared_ptr<IdentifierList> &captures() const { return captures_; }
+  const inference::Type type() const { return type_; }
+ private:
+  bool equals(const Node &b) const;
+  const std::shared_ptr<Identifier> function_;
+  const std::shared_ptr<IdentifierList> captures_;
   inference::Type type_;
 };
 
@@ -161,11 +235,12 @@ class Label : public Node {
  public:
   Label(std::string name,
         std::shared_ptr<Node> expression) :
+    Node(Kind::Label),
     name_(name),
     expression_(expression) {}
   void accept(Visitor& v) const;
   const std::string name() const { return name_; }
-  const std::shared_ptr<Node> expression() const { return expression_; }
+  const std::shared_ptr<Node> &expression() const { return expression_; }
   const inference::Type type() const { return expression_->type(); }
  private:
   bool equals(const Node &b) const;
@@ -173,24 +248,36 @@ class Label : public Node {
   std::shared_ptr<Node> expression_;
 };
 
+// Ordered by name, which after inference is also the order of the callee's
+// parameters.
 using Labels = std::map<std::string, std::shared_ptr<Label>>;
 class Application : public Node {
  public:
   Application(std::shared_ptr<Identifier> ident,
               std::shared_ptr<Labels> labels) :
+    Node(Kind::Application),
     identifier_(ident),
     labels_(labels),
     type_(inference::NoType()) {}
   Application(std::shared_ptr<Identifier> ident,
               std::shared_ptr<Labels> labels,
               inference::Type type) :
+    Node(Kind::Application),
     identifier_(ident),
     labels_(labels),
     type_(type) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Identifier> identifier() const { return identifier_; }
-  const std::shared_ptr<Labels> labels() const { return labels_; }
-  const inference::Type type() const { return type_; }
+  const std::shared_ptr<Identifier> &identifier() const { return identifier_; }
+  const std::shared_ptr<Labels> &labels() const { return labels_; }
+  // The type of the callee at this call site, the application itself has the
+  // type of the callee's result.
+  const inference::Type function_type() const { return type_; }
+  const inference::Type type() const {
+    if(std::holds_alternative<inference::FunctionType>(type_)) {
+      return std::get<inference::FunctionType>(type_).ret();
+    }
+    return type_;
+  }
  private:
   bool equals(const Node& b) const;
   const std::shared_ptr<Identifier> identifier_;
@@ -203,21 +290,23 @@ class Conditional : public Node {
   Conditional(std::shared_ptr<Node> expression,
               std::shared_ptr<Program> true_block,
               std::shared_ptr<Program> false_block) :
+    Node(Kind::Conditional),
     expression_(expression),
     true_block_(true_block),
     false_block_(false_block) {}
   Conditional(std::shared_ptr<Node> expression,
               std::shared_ptr<Program> true_block) :
+    Node(Kind::Conditional),
     expression_(expression),
     true_block_(true_block),
     false_block_(std::make_shared<Program>()) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Node> expression() const { return expression_; }
-  const std::shared_ptr<Program> true_block() const { return true_block_; }
-  const std::shared_ptr<Program> false_block() const { return false_block_; }
+  const std::shared_ptr<Node> &expression() const { return expression_; }
+  const std::shared_ptr<Program> &true_block() const { return true_block_; }
+  const std::shared_ptr<Program> &false_block() const { return false_block_; }
   const inference::Type type() const { return true_type(); }
   const inference::Type true_type() const { return true_block_->type(); }
-  const inference::Type false_type() const { return true_block_->type(); }
+  const inference::Type false_type() const { return false_block_->type(); }
  private:
   bool equals(const Node& b) const;
   const std::shared_ptr<Node> expression_;
@@ -225,6 +314,98 @@ class Conditional : public Node {
   const std::shared_ptr<Program> false_block_;
 };
 
+// The fields of a record literal, in the order they were written. Unlike
+// labels a name may appear more than once, the first one shadows the rest.
+using Fields = std::vector<std::shared_ptr<Label>>;
+
+// A record literal, optionally extending another record with more fields.
+class Record : public Node {
+ public:
+  Record(std::shared_ptr<Fields> fields) :
+    Node(Kind::Record),
+    fields_(fields),
+    base_(std::make_shared<EmptyExpression>()),
+    type_(inference::NoType()) {}
+  Record(std::shared_ptr<Fields> fields,
+         std::shared_ptr<Node> base) :
+    Node(Kind::Record),
+    fields_(fields),
+    base_(base),
+    type_(inference::NoType()) {}
+  Record(std::shared_ptr<Fields> fields,
+         std::shared_ptr<Node> base,
+         inference::Type type) :
+    Node(Kind::Record),
+    fields_(fields),
+    base_(base),
+    type_(type) {}
+  void accept(Visitor& v) const;
+  const std::shared_ptr<Fields> &fields() const { return fields_; }
+  const std::shared_ptr<Node> &base() const { return base_; }
+  const inference::Type type() const { return type_; }
+ private:
+  bool equals(const Node& b) const;
+  const std::shared_ptr<Fields> fields_;
+  const std::shared_ptr<Node> base_;
+  inference::Type type_;
+};
+
+class Selection : public Node {
+ public:
+  Selection(std::shared_ptr<Node> record,
+            std::string label) :
+    Node(Kind::Selection),
+    record_(record),
+    label_(label),
+    type_(inference::NoType()) {}
+  Selection(std::shared_ptr<Node> record,
+            std::string label,
+            inference::Type type) :
+    Node(Kind::Selection),
+    record_(record),
+    label_(label),
+    type_(type) {}
+  void accept(Visitor& v) const;
+  const std::shared_ptr<Node> &record() const { return record_; }
+  const std::string label() const { return label_; }
+  const inference::Type type() const { return type_; }
+ private:
+  bool equals(const Node& b) const;
+  const std::shared_ptr<Node> record_;
+  const std::string label_;
+  inference::Type type_;
+};
+
+// Runs its program `count` times. The optional counter starts at the value
+// of its argument, or zero, and goes up by one each time round. The loop has
+// the value of its last iteration.
+class Loop : public Node {
+ public:
+  Loop(std::shared_ptr<Node> count,
+       std::shared_ptr<Program> program) :
+    Node(Kind::Loop),
+    count_(count),
+    counter_(nullptr),
+    program_(program) {}
+  Loop(std::shared_ptr<Node> count,
+       std::shared_ptr<Argument> counter,
+       std::shared_ptr<Program> program) :
+    Node(Kind::Loop),
+    count_(count),
+    counter_(counter),
+    program_(program) {}
+  void accept(Visitor& v) const;
+  const std::shared_ptr<Node> &count() const { return count_; }
+  const std::shared_ptr<Argument> &counter() const { return counter_; }
+  const std::shared_ptr<Program> &program() const { return program_; }
+  const inference::Type type() const { return program_->type(); }
+ private:
+  bool equals(const Node& b) const;
+  const std::shared_ptr<Node> count_;
+  const std::shared_ptr<Argument> counter_;
+  const std::shared_ptr<Program> program_;
+};
+
 enum Ops {
   Addition = 0,
   Subtraction,
@@ -237,21 +418,32 @@ class Operation : public Node {
   Operation(std::shared_ptr<Node> lhs,
             std::shared_ptr<Node> rhs,
             Ops op) :
+    Node(Kind::Operation),
+    lhs_(lhs),
+    rhs_(rhs),
+    op_(op),
+    type_(inference::NumberType()) {}
+  // Addition also joins strings, so its type comes from inference.
+  Operation(std::shared_ptr<Node> lhs,
+            std::shared_ptr<Node> rhs,
+            Ops op,
+            inference::Type type) :
+    Node(Kind::Operation),
     lhs_(lhs),
     rhs_(rhs),
-    op_(op) {}
+    op_(op),
+    type_(type) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Node> left() const { return lhs_; }
-  const std::shared_ptr<Node> right() const { return rhs_; }
+  const std::shared_ptr<Node> &left() const { return lhs_; }
+  const std::shared_ptr<Node> &right() const { return rhs_; }
   Ops operation() const { return op_; }
-  const inference::Type type() const {
-    return inference::Type(inference::NumberType());
-  }
+  const inference::Type type() const { return type_; }
  private:
   bool equals(const Node& b) const;
   const std::shared_ptr<Node> lhs_;
   const std::shared_ptr<Node> rhs_;
   const Ops op_;
+  const inference::Type type_;
 };
 
 class Declaration : public Node {
@@ -259,14 +451,15 @@ class Declaration : public Node {
   Declaration(std::shared_ptr<Identifier> ident,
               std::shared_ptr<Node> value,
               std::shared_ptr<Node> expression) :
+    Node(Kind::Declaration),
     identifier_(ident),
     value_(value),
     expression_(expression) {}
   void accept(Visitor& v) const;
-  const std::shared_ptr<Identifier> identifier() const { return identifier_; }
-  const std::shared_ptr<Node> expression() const { return expression_; }
-  const std::shared_ptr<Node> value() const { return value_; }
-  const inference::Type type() const { return identifier_->type(); }
+  const std::shared_ptr<Identifier> &identifier() const { return identifier_; }
+  const std::shared_ptr<Node> &expression() const { return expression_; }
+  const std::shared_ptr<Node> &value() const { return value_; }
+  const inference::Type type() const { return expression_->type(); }
  private:
   bool equals(const Node& b) const;
   const std::shared_ptr<Identifier> identifier_;
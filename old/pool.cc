@@ -0,0 +1,106 @@
+#include "pool.hh"
+
+using namespace goat::util;
+
+namespace {
+// Which pool the current thread works for, and its queue there.
+thread_local const Pool *owner = nullptr;
+thread_local size_t position = 0;
+}
+
+Pool::Pool(size_t threads) :
+  queues_(),
+  workers_(),
+  queued_(0),
+  idle_(),
+  wake_(),
+  done_(false) {
+  if(threads == 0) threads = 1;
+  for(size_t i = 0; i <= threads; i++) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for(size_t i = 0; i < threads; i++) {
+    workers_.emplace_back([this, i]() { work(i); });
+  }
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> guard(idle_);
+    done_ = true;
+  }
+  wake_.notify_all();
+  for(auto &w : workers_) {
+    w.join();
+  }
+}
+
+size_t Pool::self() const {
+  return owner == this ? position : queues_.size() - 1;
+}
+
+void Pool::work(size_t index) {
+  owner = this;
+  position = index;
+  while(!done_) {
+    if(execute(index)) continue;
+    std::unique_lock<std::mutex> lock(idle_);
+    wake_.wait(lock, [this]() { return done_ || queued_ > 0; });
+  }
+}
+
+// Runs one task, our own newest first, then the oldest of someone else's.
+bool Pool::execute(size_t index) {
+  std::function<void()> task;
+  {
+    auto &own = *queues_[index];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if(!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+    }
+  }
+  for(size_t i = 1; !task && i < queues_.size(); i++) {
+    auto &other = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> guard(other.lock);
+    if(!other.tasks.empty()) {
+      task = std::move(other.tasks.front());
+      other.tasks.pop_front();
+    }
+  }
+  if(!task) return false;
+  queued_--;
+  task();
+  return true;
+}
+
+void Pool::run(std::vector<std::function<void()>> tasks) {
+  if(tasks.empty()) return;
+  auto index = self();
+  auto pending = std::make_shared<std::atomic<size_t>>(tasks.size());
+  // Keep the first task for ourselves, the rest are up for stealing.
+  auto first = std::move(tasks.front());
+  {
+    std::lock_guard<std::mutex> guard(idle_);
+    queued_ += tasks.size() - 1;
+  }
+  {
+    auto &own = *queues_[index];
+    std::lock_guard<std::mutex> guard(own.lock);
+    for(size_t i = tasks.size() - 1; i > 0; i--) {
+      auto task = std::move(tasks[i]);
+      own.tasks.push_back([task, pending]() {
+        task();
+        pending->fetch_sub(1);
+      });
+    }
+  }
+  wake_.notify_all();
+  first();
+  pending->fetch_sub(1);
+  while(pending->load() > 0) {
+    if(!execute(index)) {
+      std::this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef SRC_POOL_
+#define SRC_POOL_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace goat {
+namespace util {
+
+// A fork/join pool. Every worker has its own deque of tasks: it pushes and
+// pops at the back and idle workers steal from the front of the others, so
+// big subtrees forked early are the ones that move between threads.
+//
+// A thread waiting on its tasks keeps running queued work instead of
+// blocking, so tasks may fork and join tasks of their own.
+class Pool {
+ public:
+  Pool(size_t threads = std::thread::hardware_concurrency());
+  ~Pool();
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+  // Runs every task, returning once they have all finished.
+  void run(std::vector<std::function<void()>> tasks);
+  size_t size() const { return workers_.size(); }
+ private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+  };
+  void work(size_t index);
+  bool execute(size_t index);
+  size_t self() const;
+  // One queue per worker and a last one shared by outside threads.
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  // Tasks waiting in any queue, idle workers sleep until there are some.
+  std::atomic<size_t> queued_;
+  std::mutex idle_;
+  std::condition_variable wake_;
+  std::atomic<bool> done_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hh"
+
+using namespace goat::serving;
+
+namespace {
+// Bigger bodies are refused rather than buffered.
+const size_t limit = size_t(256) << 20;
+
+bool write_all(int socket, const char *data, size_t size) {
+  while(size > 0) {
+    auto written = ::send(socket, data, size, MSG_NOSIGNAL);
+    if(written < 0 && errno == EINTR) continue;
+    if(written <= 0) return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool read_all(int socket, char *data, size_t size) {
+  while(size > 0) {
+    auto got = ::recv(socket, data, size, 0);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) return false;
+    data += got;
+    size -= got;
+  }
+  return true;
+}
+}
+
+bool goat::serving::send(int socket, const Message &message) {
+  auto header = message.command + " " +
+    std::to_string(message.body.size()) + "\n";
+  return write_all(socket, header.data(), header.size()) &&
+    write_all(socket, message.body.data(), message.body.size());
+}
+
+std::optional<Message> goat::serving::receive(int socket) {
+  std::string header;
+  char c;
+  while(header.size() < 64) {
+    if(!read_all(socket, &c, 1)) return std::nullopt;
+    if(c == '\n') break;
+    header.push_back(c);
+  }
+  auto space = header.find(' ');
+  if(c != '\n' || space == std::string::npos) {
+    return std::nullopt;
+  }
+  char *end;
+  auto size = std::strtoull(header.c_str() + space + 1, &end, 10);
+  if(*end != '\0' || size > limit) {
+    return std::nullopt;
+  }
+  Message message = {header.substr(0, space), std::string(size, '\0')};
+  if(!read_all(socket, &message.body[0], size)) {
+    return std::nullopt;
+  }
+  return message;
+}
+
+std::optional<Message> goat::serving::request(const std::string &path,
+                                              const Message &message) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(address.sun_path)) {
+    return std::nullopt;
+  }
+  std::strcpy(address.sun_path, path.c_str());
+  int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(socket < 0) {
+    return std::nullopt;
+  }
+  std::optional<Message> reply;
+  if(connect(socket, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) == 0 &&
+     send(socket, message)) {
+    reply = receive(socket);
+  }
+  close(socket);
+  return reply;
+}
@@ -0,0 +1,40 @@
+#ifndef SRC_PROTOCOL_
+#define SRC_PROTOCOL_
+
+#include <optional>
+#include <string>
+
+namespace goat {
+namespace serving {
+
+// What goes over the compile server's socket, one request and one reply per
+// connection. A message is a header line, the command and the length of the
+// body, then the body: "run 42\n" and 42 bytes of source.
+//
+// Requests are
+//   run      runs the program on the bytecode machine, replies with its value
+//   bitcode  replies with the program's LLVM bitcode
+//   compile  replies with a native object file, or an archive of them
+//   open     "name\n" and a source, keeps it as a document for edits
+//   edit     "name offset length\n" and the text to put there
+//   close    "name\n", forgets the document
+// and replies are "ok" with the result or "error" with a message. Opening
+// and editing reply with the document's type, only relexing, reparsing and
+// inferring it again as far as the edit needs.
+struct Message {
+  std::string command;
+  std::string body;
+};
+
+bool send(int socket, const Message &message);
+std::optional<Message> receive(int socket);
+
+// Connects to the server listening on `path`, sends the request and waits
+// for the reply. Nothing if the server couldn't be reached.
+std::optional<Message> request(const std::string &path,
+                               const Message &message);
+
+}
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cmath>
+
+#include "node.hh"
+#include "ranges.hh"
+
+using namespace goat::node;
+using namespace goat::compiling;
+
+// Every integer up to 2^53 in magnitude has an exact double.
+const double exact = 9007199254740992.0;
+
+static bool contains_zero(const Range &r) {
+  return r.low <= 0 && r.high >= 0;
+}
+
+void IntegerRanges::record(const Node &node, Range range) {
+  if(range.low < -exact || range.high > exact) {
+    return;
+  }
+  ranges_[&node] = range;
+}
+
+bool IntegerRanges::integral(const Node &node) const {
+  return ranges_.find(&node) != ranges_.end();
+}
+
+const Range *IntegerRanges::range(const Node &node) const {
+  auto r = ranges_.find(&node);
+  return r == ranges_.end() ? nullptr : &r->second;
+}
+
+void IntegerRanges::visit(const Number &number) {
+  auto value = number.value();
+  // -0 has no integer counterpart, it has to stay a double.
+  if(std::trunc(value) != value || std::signbit(value)) {
+    return;
+  }
+  record(number, {value, value});
+}
+
+void IntegerRanges::visit(const Identifier &identifier) {
+  auto v = variables_.find(identifier.internal_value());
+  if(v != variables_.end()) {
+    record(identifier, v->second);
+  }
+}
+
+void IntegerRanges::visit(const Operation &operation) {
+  Visitor::visit(operation);
+  auto left = range(*operation.left());
+  auto right = range(*operation.right());
+  if(!left || !right) {
+    return;
+  }
+
+  switch(operation.operation()) {
+  case Addition:
+    record(operation, {left->low + right->low, left->high + right->high});
+    break;
+  case Subtraction:
+    record(operation, {left->low - right->high, left->high - right->low});
+    break;
+  case Multiplication: {
+    // Zero times a negative number is -0 in floating point.
+    if((contains_zero(*left) && right->low < 0) ||
+       (contains_zero(*right) && left->low < 0)) {
+      return;
+    }
+    auto corners = {left->low * right->low, left->low * right->high,
+                    left->high * right->low, left->high * right->high};
+    record(operation, {std::min(corners), std::max(corners)});
+    break;
+  }
+  case Division:
+    break;
+  }
+}
+
+// The counter runs from its start up to one less than the count past it.
+void IntegerRanges::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = range(*loop.count());
+  if(loop.counter() != nullptr) {
+    auto expression = loop.counter()->expression();
+    expression->accept(*this);
+    Range zero = {0, 0};
+    auto start = *expression == EmptyExpression() ? &zero : range(*expression);
+    if(count && start) {
+      variables_[loop.counter()->identifier()->internal_value()] = {
+        start->low,
+        start->high + std::max(count->high - 1, 0.0)
+      };
+    }
+  }
+  loop.program()->accept(*this);
+}
+
+void IntegerRanges::visit(const Declaration &declaration) {
+  declaration.value()->accept(*this);
+  auto value = range(*declaration.value());
+  if(value) {
+    variables_[declaration.identifier()->internal_value()] = *value;
+  }
+  declaration.expression()->accept(*this);
+  auto expression = range(*declaration.expression());
+  if(expression) {
+    record(declaration, *expression);
+  }
+}
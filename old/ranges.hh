@@ -0,0 +1,43 @@
+#ifndef SRC_RANGES_
+#define SRC_RANGES_
+
+#include <string>
+#include <unordered_map>
+
+#include "node.hh"
+#include "visitor.hh"
+
+namespace goat {
+namespace compiling {
+
+// Bounds of an expression that is known to only ever hold integers.
+struct Range {
+  double low;
+  double high;
+};
+
+// Finds the numeric expressions that are provably integral and small enough
+// that a double holds them exactly. Computing those in i64 gives the same
+// answer as the double path, so the compiler is free to pick either.
+class IntegerRanges : public node::Visitor {
+public:
+  IntegerRanges() :
+    ranges_(),
+    variables_() {}
+  void visit(const node::Number &number);
+  void visit(const node::Identifier &identifier);
+  void visit(const node::Operation &operation);
+  void visit(const node::Loop &loop);
+  void visit(const node::Declaration &declaration);
+  bool integral(const node::Node &node) const;
+  const Range *range(const node::Node &node) const;
+private:
+  void record(const node::Node &node, Range range);
+  std::unordered_map<const node::Node *, Range> ranges_;
+  std::unordered_map<std::string, Range> variables_;
+};
+
+}
+}
+
+#endif
@@ -1,4 +1,4 @@
-#include <gsl/gsl>
+#include <optional>
 
 #include "node.hh"
 #include "renamer.hh"
@@ -10,10 +10,21 @@ std::shared_ptr<node::Program> Renamer::rename(std::shared_ptr<node::Program> pr
   return clone(program);
 }
 
+std::string Renamer::declare(const std::string &name) {
+  return names_[name] = namer_.next();
+}
+
+std::unique_ptr<node::TreeCloner> Renamer::split() const {
+  return std::make_unique<Renamer>(*this);
+}
+
+// A name nothing binds gets one of its own, for the Inferer to report.
 void Renamer::visit(const node::Identifier &identifier) {
-  Expects(names_.find(identifier.value()) != names_.end());
-  child_ = std::make_shared<node::Identifier>(identifier.value(),
-                                              names_[identifier.value()]);
+  auto name = names_.find(identifier.value());
+  child_ = std::make_shared<node::Identifier>(
+    identifier.value(),
+    name == names_.end() ? namer_.next() : name->second
+  );
 }
 
 void Renamer::visit(const node::Function &function) {
@@ -25,7 +36,97 @@ void Renamer::visit(const node::Function &function) {
   names_ = names;
 }
 
+// The counter is only in scope inside the loop, and the count is outside it.
+void Renamer::visit(const node::Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = child_;
+  if(loop.counter() == nullptr) {
+    loop.program()->accept(*this);
+    child_ = std::make_shared<node::Loop>(
+      count,
+      std::static_pointer_cast<node::Program>(child_)
+    );
+    return;
+  }
+
+  auto names = names_;
+  names_[loop.counter()->identifier()->value()] = namer_.next();
+  loop.counter()->accept(*this);
+  auto counter = std::static_pointer_cast<node::Argument>(child_);
+  loop.program()->accept(*this);
+  child_ = std::make_shared<node::Loop>(
+    count,
+    counter,
+    std::static_pointer_cast<node::Program>(child_)
+  );
+  names_ = names;
+}
+
+// The name is in scope in the value, for recursion, and the expression, but
+// not after them.
 void Renamer::visit(const node::Declaration &declaration) {
-  names_[declaration.identifier()->value()] = namer_.next();
+  auto name = declaration.identifier()->value();
+  auto outer = names_.find(name);
+  auto shadowed = outer == names_.end() ? std::nullopt
+                                        : std::optional(outer->second);
+  names_[name] = namer_.next();
   TreeCloner::visit(declaration);
+  if(shadowed) {
+    names_[name] = *shadowed;
+  } else {
+    names_.erase(name);
+  }
+}
+
+std::shared_ptr<node::Program> StaticRenamer::rename(std::shared_ptr<node::Program> program) {
+  return clone(program);
+}
+
+std::shared_ptr<node::Identifier> StaticRenamer::visit(const node::Identifier &identifier) {
+  auto name = names_.find(identifier.value());
+  return std::make_shared<node::Identifier>(
+    identifier.value(),
+    name == names_.end() ? namer_.next() : name->second
+  );
+}
+
+std::shared_ptr<node::Function> StaticRenamer::visit(const node::Function &function) {
+  auto names = names_;
+  for(auto a : *function.arguments()) {
+    names_[a->identifier()->value()] = namer_.next();
+  }
+  auto renamed = StaticCloner::visit(function);
+  names_ = names;
+  return renamed;
+}
+
+std::shared_ptr<node::Loop> StaticRenamer::visit(const node::Loop &loop) {
+  auto count = visit(*loop.count());
+  if(loop.counter() == nullptr) {
+    return std::make_shared<node::Loop>(count, visit(*loop.program()));
+  }
+
+  auto names = names_;
+  names_[loop.counter()->identifier()->value()] = namer_.next();
+  auto counter = visit(*loop.counter());
+  auto renamed = std::make_shared<node::Loop>(count,
+                                              counter,
+                                              visit(*loop.program()));
+  names_ = names;
+  return renamed;
+}
+
+std::shared_ptr<node::Declaration> StaticRenamer::visit(const node::Declaration &declaration) {
+  auto name = declaration.identifier()->value();
+  auto outer = names_.find(name);
+  auto shadowed = outer == names_.end() ? std::nullopt
+                                        : std::optional(outer->second);
+  names_[name] = namer_.next();
+  auto renamed = StaticCloner::visit(declaration);
+  if(shadowed) {
+    names_[name] = *shadowed;
+  } else {
+    names_.erase(name);
+  }
+  return renamed;
 }
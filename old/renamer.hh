@@ -5,6 +5,7 @@
 #include <map>
 
 #include "node.hh"
+#include "static_visitor.hh"
 #include "visitor.hh"
 #include "util.hh"
 
@@ -20,6 +21,30 @@ class Renamer : public node::TreeCloner {
   void visit(const node::Declaration &declaration);
   void visit(const node::Function &function);
   void visit(const node::Identifier &identifier);
+  void visit(const node::Loop &loop);
+  // Brings a name bound outside the program into scope, returning its
+  // internal name.
+  std::string declare(const std::string &name);
+  std::shared_ptr<node::Program> rename(std::shared_ptr<node::Program> program);
+ protected:
+  // Copies share the namer, so renaming subtrees in parallel is safe.
+  std::unique_ptr<node::TreeCloner> split() const;
+ private:
+  std::map<std::string, std::string> names_;
+  util::Namer namer_;
+};
+
+// The same pass over the switch based traversal, to compare dispatch costs.
+class StaticRenamer : public node::StaticCloner<StaticRenamer> {
+ public:
+  using StaticCloner<StaticRenamer>::visit;
+  StaticRenamer() :
+    names_(),
+    namer_() {}
+  std::shared_ptr<node::Declaration> visit(const node::Declaration &declaration);
+  std::shared_ptr<node::Function> visit(const node::Function &function);
+  std::shared_ptr<node::Identifier> visit(const node::Identifier &identifier);
+  std::shared_ptr<node::Loop> visit(const node::Loop &loop);
   std::shared_ptr<node::Program> rename(std::shared_ptr<node::Program> program);
  private:
   std::map<std::string, std::string> names_;
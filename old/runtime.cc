@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+#include "runtime.hh"
+
+using namespace goat::runtime;
+
+static_assert(sizeof(goat_string) == 16, "goat.string is two words");
+
+namespace {
+
+// Heap storage for strings too big to be small. Bytes up to `used` belong to
+// some string, and the ones after are free for whoever ends at `used`.
+struct Buffer {
+  uint64_t capacity;
+  uint64_t used;
+  char *bytes() { return reinterpret_cast<char *>(this + 1); }
+  static Buffer *of(const goat_string *string) {
+    return reinterpret_cast<Buffer *>(const_cast<char *>(string->data)) - 1;
+  }
+};
+
+// The size lives in the top byte of a small string, which is also the top
+// byte of its second word on the little endian targets we compile for.
+char *small(goat_string *string) {
+  return reinterpret_cast<char *>(string);
+}
+
+void make_small(goat_string *out, const char *left, size_t left_size,
+                const char *right, size_t right_size) {
+  goat_string string = {nullptr, 0};
+  memcpy(small(&string), left, left_size);
+  memcpy(small(&string) + left_size, right, right_size);
+  small(&string)[kSmallSize] =
+    static_cast<char>((kSmall >> 56) | (left_size + right_size));
+  *out = string;
+}
+
+}
+
+size_t goat_string_size(const goat_string *string) {
+  if((string->word & kKind) == kSmall) {
+    return (string->word >> 56) & ~(kKind >> 56);
+  }
+  return string->word & ~kKind;
+}
+
+const char *goat_string_data(const goat_string *string) {
+  if((string->word & kKind) == kSmall) {
+    return reinterpret_cast<const char *>(string);
+  }
+  return string->data;
+}
+
+void goat_string_concat(goat_string *out,
+                        const goat_string *left,
+                        const goat_string *right) {
+  size_t left_size = goat_string_size(left);
+  size_t right_size = goat_string_size(right);
+  // Copy the operands first, out may alias either of them.
+  goat_string l = *left, r = *right;
+  if(right_size == 0) {
+    *out = l;
+    return;
+  }
+  if(left_size == 0) {
+    *out = r;
+    return;
+  }
+
+  size_t size = left_size + right_size;
+  if(size <= kSmallSize) {
+    make_small(out, goat_string_data(&l), left_size,
+               goat_string_data(&r), right_size);
+    return;
+  }
+
+  // Grow in place when the left side is the last string in its buffer.
+  if((l.word & kKind) == kBuffer) {
+    auto buffer = Buffer::of(&l);
+    if(buffer->used == left_size && size <= buffer->capacity) {
+      memcpy(buffer->bytes() + left_size, goat_string_data(&r), right_size);
+      buffer->used = size;
+      *out = {l.data, kBuffer | size};
+      return;
+    }
+  }
+
+  // Leave as much room again for whatever gets appended next.
+  size_t capacity = std::max<size_t>(size * 2, 64);
+  auto buffer = static_cast<Buffer *>(goat_alloc(sizeof(Buffer) + capacity));
+  buffer->capacity = capacity;
+  buffer->used = size;
+  memcpy(buffer->bytes(), goat_string_data(&l), left_size);
+  memcpy(buffer->bytes() + left_size, goat_string_data(&r), right_size);
+  *out = {buffer->bytes(), kBuffer | size};
+}
+
+namespace {
+
+const size_t kAlign = 16;
+const size_t kChunkSize = 64 * 1024;
+
+size_t align(size_t size) {
+  return (size + kAlign - 1) & ~(kAlign - 1);
+}
+
+std::atomic<uint64_t> region_bytes(0);
+std::atomic<uint64_t> region_peak(0);
+std::atomic<uint64_t> heap_bytes(0);
+std::atomic<uint64_t> heap_live(0);
+std::atomic<uint64_t> collections(0);
+
+// Regions are a stack of chunks, and a mark is the bump pointer at the
+// time it was taken.
+struct alignas(16) Chunk {
+  Chunk *prev;
+  size_t size;
+  size_t used;
+  char *bytes() { return reinterpret_cast<char *>(this + 1); }
+  bool holds(const char *mark) { return mark >= bytes() && mark <= bytes() + size; }
+};
+static_assert(sizeof(Chunk) % kAlign == 0, "chunks keep payloads aligned");
+
+struct Region {
+  Chunk *top;
+  // Kept around after a reset so a loop of calls doesn't malloc every time.
+  Chunk *spare;
+  size_t depth;
+  size_t in_use;
+};
+thread_local Region region = {nullptr, nullptr, 0, 0};
+
+void *region_alloc(size_t size) {
+  size = align(size);
+  if(!region.top || region.top->used + size > region.top->size) {
+    Chunk *chunk = region.spare;
+    if(chunk && chunk->size >= size) {
+      region.spare = nullptr;
+    } else {
+      chunk = static_cast<Chunk *>(
+        malloc(sizeof(Chunk) + std::max(size, kChunkSize)));
+      chunk->size = std::max(size, kChunkSize);
+    }
+    chunk->prev = region.top;
+    chunk->used = 0;
+    region.top = chunk;
+  }
+  void *memory = region.top->bytes() + region.top->used;
+  region.top->used += size;
+  region.in_use += size;
+  region_bytes += size;
+  uint64_t peak = region_peak;
+  while(region.in_use > peak &&
+        !region_peak.compare_exchange_weak(peak, region.in_use)) {}
+  // The collector scans regions, so stale pointers mustn't keep garbage.
+  memset(memory, 0, size);
+  return memory;
+}
+
+// Every heap object, keyed by where its payload starts so an interior
+// pointer finds it with one lookup.
+struct alignas(16) Object {
+  size_t size;
+  bool marked;
+};
+static_assert(sizeof(Object) % kAlign == 0, "objects keep payloads aligned");
+
+struct Heap {
+  std::mutex lock;
+  std::map<uintptr_t, Object *> objects;
+  size_t since;
+  size_t threshold;
+};
+Heap heap = {{}, {}, 0, 1 << 20};
+
+Object *find(uintptr_t word) {
+  auto o = heap.objects.upper_bound(word);
+  if(o == heap.objects.begin()) {
+    return nullptr;
+  }
+  o--;
+  return word < o->first + o->second->size ? o->second : nullptr;
+}
+
+void scan(const void *begin, const void *end, std::vector<Object *> &work) {
+  auto from = reinterpret_cast<uintptr_t>(begin) & ~(sizeof(uintptr_t) - 1);
+  auto to = reinterpret_cast<uintptr_t>(end);
+  for(auto w = from; w + sizeof(uintptr_t) <= to; w += sizeof(uintptr_t)) {
+    auto object = find(*reinterpret_cast<const uintptr_t *>(w));
+    if(object && !object->marked) {
+      object->marked = true;
+      work.push_back(object);
+    }
+  }
+}
+
+const void *stack_top() {
+  thread_local const void *top = nullptr;
+  if(!top) {
+    pthread_attr_t attr;
+    void *base;
+    size_t size;
+    pthread_getattr_np(pthread_self(), &attr);
+    pthread_attr_getstack(&attr, &base, &size);
+    pthread_attr_destroy(&attr);
+    top = static_cast<char *>(base) + size;
+  }
+  return top;
+}
+
+__attribute__((noinline)) void collect() {
+  // Spill callee saved registers so the stack scan sees them.
+  jmp_buf registers;
+  setjmp(registers);
+  std::vector<Object *> work;
+  scan(&registers, stack_top(), work);
+  for(auto chunk = region.top; chunk; chunk = chunk->prev) {
+    scan(chunk->bytes(), chunk->bytes() + chunk->used, work);
+  }
+  while(!work.empty()) {
+    auto object = work.back();
+    work.pop_back();
+    scan(object + 1, reinterpret_cast<char *>(object + 1) + object->size, work);
+  }
+
+  size_t live = 0;
+  for(auto o = heap.objects.begin(); o != heap.objects.end();) {
+    if(o->second->marked) {
+      o->second->marked = false;
+      live += o->second->size;
+      o++;
+    } else {
+      free(o->second);
+      o = heap.objects.erase(o);
+    }
+  }
+  heap.since = 0;
+  heap.threshold = std::max<size_t>(live * 2, 1 << 20);
+  heap_live = live;
+  collections++;
+}
+
+void *heap_alloc(size_t size) {
+  size = align(size);
+  std::lock_guard<std::mutex> guard(heap.lock);
+  if(heap.since > heap.threshold) {
+    collect();
+  }
+  auto object = static_cast<Object *>(calloc(1, sizeof(Object) + size));
+  object->size = size;
+  heap.objects[reinterpret_cast<uintptr_t>(object + 1)] = object;
+  heap.since += size;
+  heap_bytes += size;
+  return object + 1;
+}
+
+void report() {
+  goat_memory_report(stderr);
+}
+
+struct Report {
+  Report() {
+    if(getenv("GOAT_MEMORY_STATS")) {
+      atexit(report);
+    }
+  }
+} at_exit;
+
+}
+
+void *goat_alloc(size_t size) {
+  return region.depth ? region_alloc(size) : heap_alloc(size);
+}
+
+void *goat_region_enter() {
+  region.depth++;
+  return region.top ? region.top->bytes() + region.top->used : nullptr;
+}
+
+void goat_region_reset(void *mark) {
+  auto at = static_cast<char *>(mark);
+  while(region.top && !(at && region.top->holds(at))) {
+    auto chunk = region.top;
+    region.top = chunk->prev;
+    region.in_use -= chunk->used;
+    if(!region.spare || region.spare->size < chunk->size) {
+      std::swap(region.spare, chunk);
+    }
+    free(chunk);
+  }
+  if(region.top) {
+    auto used = static_cast<size_t>(at - region.top->bytes());
+    region.in_use -= region.top->used - used;
+    region.top->used = used;
+  }
+}
+
+void goat_region_leave(void *mark) {
+  goat_region_reset(mark);
+  region.depth--;
+}
+
+void goat_memory_usage(goat_memory_stats *stats) {
+  stats->region_bytes = region_bytes;
+  stats->heap_bytes = heap_bytes;
+  stats->region_peak = region_peak;
+  stats->heap_live = heap_live;
+  stats->collections = collections;
+}
+
+void goat_memory_report(FILE *out) {
+  goat_memory_stats stats;
+  goat_memory_usage(&stats);
+  fprintf(out,
+          "region: %llu bytes, %llu peak\n"
+          "heap: %llu bytes, %llu live after %llu collections\n",
+          (unsigned long long) stats.region_bytes,
+          (unsigned long long) stats.region_peak,
+          (unsigned long long) stats.heap_bytes,
+          (unsigned long long) stats.heap_live,
+          (unsigned long long) stats.collections);
+}
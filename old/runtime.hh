@@ -0,0 +1,78 @@
+#ifndef SRC_RUNTIME_
+#define SRC_RUNTIME_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// The runtime compiled goat programs link against. Everything in here is
+// called from generated code, so it sticks to the C calling convention.
+extern "C" {
+
+// Strings are two words, matching the compiler's goat.string. The top two
+// bits of the second word say how to read the rest:
+//
+//  constant  data points at bytes that outlive the program, the literal pool
+//            included, and the rest of the word is the size.
+//  small     up to 15 bytes are stored in the struct itself and the last
+//            byte holds the size.
+//  buffer    data points at the start of a heap buffer that may be shared
+//            with other strings, which only ever see a prefix of it.
+//
+// Strings are never mutated, but a buffer can grow past the end of every
+// string that uses it, so `s = s + x` appends in place and building a string
+// a piece at a time is linear rather than quadratic.
+struct goat_string {
+  const char *data;
+  uint64_t word;
+};
+
+size_t goat_string_size(const goat_string *string);
+const char *goat_string_data(const goat_string *string);
+void goat_string_concat(goat_string *out,
+                        const goat_string *left,
+                        const goat_string *right);
+
+// Memory comes from one of two places. Functions whose result holds no
+// pointers open a region on entry and reset it on return, since nothing
+// they allocate can outlive them, and while any region is open on a thread
+// goat_alloc bumps a pointer in it. Otherwise it allocates from a
+// conservative mark and sweep heap that scans the calling thread's stack
+// and regions for roots; compiled programs are single threaded so that is
+// all of them. Loops and self tail calls whose values hold no pointers
+// reset the region to their mark every time around.
+void *goat_alloc(size_t size);
+void *goat_region_enter();
+void goat_region_reset(void *mark);
+void goat_region_leave(void *mark);
+
+struct goat_memory_stats {
+  // Totals since the program started.
+  uint64_t region_bytes;
+  uint64_t heap_bytes;
+  // The most region memory a thread has had in use at once.
+  uint64_t region_peak;
+  // What the last collection found still reachable.
+  uint64_t heap_live;
+  uint64_t collections;
+};
+
+void goat_memory_usage(goat_memory_stats *stats);
+// Also printed to stderr on exit when GOAT_MEMORY_STATS is set.
+void goat_memory_report(FILE *out);
+
+}
+
+namespace goat {
+namespace runtime {
+
+const uint64_t kConstant = uint64_t(0) << 62;
+const uint64_t kSmall = uint64_t(1) << 62;
+const uint64_t kBuffer = uint64_t(2) << 62;
+const uint64_t kKind = uint64_t(3) << 62;
+const size_t kSmallSize = sizeof(goat_string) - 1;
+
+}
+}
+
+#endif
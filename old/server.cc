@@ -0,0 +1,222 @@
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Error.h>
+
+#include "bytecode.hh"
+#include "driver.hh"
+#include "server.hh"
+#include "vm.hh"
+
+using namespace goat;
+using namespace goat::serving;
+
+namespace {
+// How far a run may go before the server gives up on it, so a client can't
+// hold a thread or fill memory forever.
+const uint64_t fuel = uint64_t(1) << 28;
+const size_t depth = 1 << 14;
+// Connections answered at once, each on a thread of its own, and how long
+// one may take to send its request before it's dropped to make room.
+const size_t connections = 64;
+const timeval patience = {10, 0};
+// Documents kept open at once.
+const size_t documents = 256;
+}
+
+bool Server::serve() {
+  backend::initialise();
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if(path_.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::strcpy(address.sun_path, path_.c_str());
+  int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(socket < 0) {
+    return false;
+  }
+  // A socket left behind by a server that didn't stop cleanly, but nothing
+  // else that happens to be at the path.
+  struct stat status;
+  if(lstat(path_.c_str(), &status) == 0) {
+    if(!S_ISSOCK(status.st_mode)) {
+      close(socket);
+      return false;
+    }
+    unlink(path_.c_str());
+  }
+  if(bind(socket, reinterpret_cast<sockaddr *>(&address),
+          sizeof(address)) != 0 ||
+     listen(socket, SOMAXCONN) != 0) {
+    close(socket);
+    return false;
+  }
+  listener_ = socket;
+
+  while(true) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      idle_.wait(lock, [this]() { return active_ < connections; });
+    }
+    int connection = accept(socket, nullptr, nullptr);
+    if(connection < 0 && errno == EINTR) continue;
+    if(connection < 0) break;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &patience,
+               sizeof(patience));
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      active_++;
+    }
+    std::thread([this, connection]() {
+      handle(connection);
+      std::lock_guard<std::mutex> guard(lock_);
+      active_--;
+      idle_.notify_all();
+    }).detach();
+  }
+
+  std::unique_lock<std::mutex> lock(lock_);
+  idle_.wait(lock, [this]() { return active_ == 0; });
+  close(socket);
+  unlink(path_.c_str());
+  return true;
+}
+
+// Shutting the listener down wakes the accept in serve.
+void Server::stop() {
+  int socket = listener_.exchange(-1);
+  if(socket >= 0) {
+    shutdown(socket, SHUT_RDWR);
+  }
+}
+
+void Server::handle(int connection) {
+  auto request = receive(connection);
+  if(request) {
+    Message reply;
+    try {
+      reply = answer(*request);
+    } catch(const std::exception &e) {
+      reply = {"error", e.what()};
+    }
+    send(connection, reply);
+  }
+  close(connection);
+}
+
+Message Server::answer(const Message &request) {
+  driver::Report report = {"request", "", "", 0, 0, false, {}};
+  if(request.command == "run") {
+    std::set<inference::Substitution> substitutions;
+    auto typed = driver::check(request.body, substitutions, report, &pool_);
+    if(typed == nullptr) {
+      return {"error", report.error};
+    }
+    auto module = bytecode::Assembler().assemble(*typed);
+    if(!module) {
+      return {"error", "the bytecode machine can't run this program"};
+    }
+    double result;
+    if(!bytecode::Machine(fuel, depth).run(*module, result)) {
+      return {"error", "the program ran for too long"};
+    }
+    std::ostringstream value;
+    value << std::setprecision(17) << result;
+    return {"ok", value.str()};
+  }
+
+  if(request.command == "open" || request.command == "edit" ||
+     request.command == "close") {
+    return edit(request);
+  }
+
+  if(request.command != "bitcode" && request.command != "compile") {
+    return {"error", "unknown command " + request.command};
+  }
+  std::string bitcode;
+  if(!driver::compile(request.body, cache_, report, bitcode, &pool_)) {
+    return {"error", report.error};
+  }
+  if(request.command == "bitcode") {
+    return {"ok", bitcode};
+  }
+  llvm::LLVMContext context;
+  auto module = llvm::parseBitcodeFile(
+    llvm::MemoryBufferRef(bitcode, report.path),
+    context);
+  if(!module) {
+    return {"error", llvm::toString(module.takeError())};
+  }
+  std::string error;
+  auto object = backend::emit(**module, pool_, options_, error);
+  if(object == nullptr) {
+    return {"error", error};
+  }
+  return {"ok", object->getBuffer().str()};
+}
+
+// The body starts with a line naming the document, and for an edit where
+// it goes, with the text after it.
+Message Server::edit(const Message &request) {
+  auto line = request.body.find('\n');
+  if(line == std::string::npos) {
+    return {"error", "no document named"};
+  }
+  std::istringstream header(request.body.substr(0, line));
+  auto text = request.body.substr(line + 1);
+  std::string name;
+  size_t offset = 0;
+  size_t length = 0;
+  header >> name;
+  if(request.command == "edit") {
+    header >> offset >> length;
+  }
+  if(name.empty() || header.fail()) {
+    return {"error", "bad " + request.command + " header"};
+  }
+
+  std::lock_guard<std::mutex> guard(documents_lock_);
+  if(request.command == "close") {
+    documents_.erase(name);
+    return {"ok", ""};
+  }
+  if(request.command == "open") {
+    if(documents_.size() >= documents && documents_.count(name) == 0) {
+      return {"error", "too many documents open"};
+    }
+    documents_[name] = std::make_unique<editing::Document>(text);
+  }
+  auto document = documents_.find(name);
+  if(document == documents_.end()) {
+    return {"error", "no document " + name};
+  }
+  if(request.command == "edit") {
+    document->second->edit(offset, length, text);
+  }
+  if(!document->second->parsed()) {
+    return {"error", "syntax error"};
+  }
+  std::set<inference::Substitution> substitutions;
+  auto typed = document->second->check(substitutions);
+  for(auto s : substitutions) {
+    if(s.is_error()) {
+      return {"error", "type error"};
+    }
+  }
+  std::ostringstream type;
+  type << inference::resolve(substitutions, typed->type());
+  return {"ok", type.str()};
+}
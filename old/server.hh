@@ -0,0 +1,65 @@
+#ifndef SRC_SERVER_
+#define SRC_SERVER_
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "backend.hh"
+#include "cache.hh"
+#include "document.hh"
+#include "pool.hh"
+#include "protocol.hh"
+
+namespace goat {
+namespace serving {
+
+// A compile server on a Unix domain socket, so a script costs a request
+// instead of a process: the LLVM targets are set up once, the cache and
+// the pool stay open between requests, and every connection is answered on
+// a thread of its own, up to a limit. It won't replace anything at its path
+// but a socket.
+class Server {
+ public:
+  Server(std::string path,
+         util::Pool &pool,
+         const caching::Cache *cache,
+         backend::Options options) :
+    path_(path),
+    pool_(pool),
+    cache_(cache),
+    options_(options),
+    listener_(-1),
+    lock_(),
+    idle_(),
+    active_(0),
+    documents_lock_(),
+    documents_() {}
+  // Answers requests until stopped. False if it couldn't listen.
+  bool serve();
+  // Stops taking connections and waits for the ones being answered.
+  void stop();
+ private:
+  void handle(int connection);
+  Message answer(const Message &request);
+  Message edit(const Message &request);
+  std::string path_;
+  util::Pool &pool_;
+  const caching::Cache *cache_;
+  backend::Options options_;
+  std::atomic<int> listener_;
+  std::mutex lock_;
+  std::condition_variable idle_;
+  size_t active_;
+  // Documents being edited, by the name their client gave them.
+  std::mutex documents_lock_;
+  std::map<std::string, std::unique_ptr<editing::Document>> documents_;
+};
+
+}
+}
+
+#endif
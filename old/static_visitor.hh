@@ -0,0 +1,250 @@
+#ifndef SRC_STATIC_VISITOR_
+#define SRC_STATIC_VISITOR_
+
+#include <memory>
+
+#include "node.hh"
+
+namespace goat {
+namespace node {
+
+// Calls f with the node cast to its class, by switching on its kind.
+template <typename F>
+decltype(auto) dispatch(const Node &node, F &&f) {
+  switch(node.kind()) {
+  case Kind::EmptyExpression:
+    return f(static_cast<const EmptyExpression &>(node));
+  case Kind::Number:
+    return f(static_cast<const Number &>(node));
+  case Kind::Identifier:
+    return f(static_cast<const Identifier &>(node));
+  case Kind::String:
+    return f(static_cast<const String &>(node));
+  case Kind::Program:
+    return f(static_cast<const Program &>(node));
+  case Kind::Argument:
+    return f(static_cast<const Argument &>(node));
+  case Kind::Function:
+    return f(static_cast<const Function &>(node));
+  case Kind::Closure:
+    return f(static_cast<const Closure &>(node));
+  case Kind::Label:
+    return f(static_cast<const Label &>(node));
+  case Kind::Application:
+    return f(static_cast<const Application &>(node));
+  case Kind::Conditional:
+    return f(static_cast<const Conditional &>(node));
+  case Kind::Record:
+    return f(static_cast<const Record &>(node));
+  case Kind::Selection:
+    return f(static_cast<const Selection &>(node));
+  case Kind::Loop:
+    return f(static_cast<const Loop &>(node));
+  case Kind::Operation:
+    return f(static_cast<const Operation &>(node));
+  case Kind::Declaration:
+    return f(static_cast<const Declaration &>(node));
+  }
+  __builtin_unreachable();
+}
+
+// Visitor without the virtual calls: a pass derives from
+// StaticVisitor<Pass>, brings the defaults in with `using
+// StaticVisitor<Pass>::visit;` and overrides the visits it cares about.
+// Every call is resolved at compile time, so small visits inline into the
+// switch.
+template <typename Derived>
+class StaticVisitor {
+ public:
+  void visit(const Node &node) {
+    dispatch(node, [this](auto &n) { derived().visit(n); });
+  }
+  void visit(const EmptyExpression &empty) {}
+  void visit(const Number &number) {}
+  void visit(const Identifier &identifier) {}
+  void visit(const String &string) {}
+  void visit(const Program &program) {
+    derived().visit(*program.expression());
+  }
+  void visit(const Argument &argument) {
+    derived().visit(*argument.identifier());
+    derived().visit(*argument.expression());
+  }
+  void visit(const Function &function) {
+    for(auto &a : *function.arguments()) {
+      derived().visit(*a);
+    }
+    derived().visit(*function.program());
+  }
+  void visit(const Closure &closure) {
+    derived().visit(*closure.function());
+    for(auto &c : *closure.captures()) {
+      derived().visit(*c);
+    }
+  }
+  void visit(const Label &label) {
+    derived().visit(*label.expression());
+  }
+  void visit(const Application &application) {
+    derived().visit(*application.identifier());
+    for(auto &l : *application.labels()) {
+      derived().visit(*l.second);
+    }
+  }
+  void visit(const Conditional &conditional) {
+    derived().visit(*conditional.expression());
+    derived().visit(*conditional.true_block());
+    derived().visit(*conditional.false_block());
+  }
+  void visit(const Loop &loop) {
+    derived().visit(*loop.count());
+    if(loop.counter() != nullptr) {
+      derived().visit(*loop.counter());
+    }
+    derived().visit(*loop.program());
+  }
+  void visit(const Record &record) {
+    for(auto &f : *record.fields()) {
+      derived().visit(*f);
+    }
+    derived().visit(*record.base());
+  }
+  void visit(const Selection &selection) {
+    derived().visit(*selection.record());
+  }
+  void visit(const Operation &operation) {
+    derived().visit(*operation.left());
+    derived().visit(*operation.right());
+  }
+  void visit(const Declaration &declaration) {
+    derived().visit(*declaration.identifier());
+    derived().visit(*declaration.value());
+    derived().visit(*declaration.expression());
+  }
+ private:
+  Derived &derived() { return static_cast<Derived &>(*this); }
+};
+
+// TreeCloner without the virtual calls, and each visit returns the copy
+// as its own class rather than leaving it in child_.
+template <typename Derived>
+class StaticCloner {
+ public:
+  std::shared_ptr<Program> clone(std::shared_ptr<Program> program) {
+    return derived().visit(*program);
+  }
+  std::shared_ptr<Node> visit(const Node &node) {
+    return dispatch(node, [this](auto &n) -> std::shared_ptr<Node> {
+      return derived().visit(n);
+    });
+  }
+  std::shared_ptr<EmptyExpression> visit(const EmptyExpression &empty) {
+    return std::make_shared<EmptyExpression>();
+  }
+  std::shared_ptr<Number> visit(const Number &number) {
+    return std::make_shared<Number>(number);
+  }
+  std::shared_ptr<Identifier> visit(const Identifier &identifier) {
+    return std::make_shared<Identifier>(identifier);
+  }
+  std::shared_ptr<String> visit(const String &string) {
+    return std::make_shared<String>(string);
+  }
+  std::shared_ptr<Program> visit(const Program &program) {
+    return std::make_shared<Program>(derived().visit(*program.expression()));
+  }
+  std::shared_ptr<Argument> visit(const Argument &argument) {
+    auto identifier = derived().visit(*argument.identifier());
+    return std::make_shared<Argument>(identifier,
+                                      derived().visit(*argument.expression()));
+  }
+  std::shared_ptr<Function> visit(const Function &function) {
+    auto args = std::make_shared<ArgumentList>();
+    for(auto &a : *function.arguments()) {
+      args->push_back(derived().visit(*a));
+    }
+    auto captures = std::make_shared<IdentifierList>();
+    for(auto &c : *function.captures()) {
+      captures->push_back(derived().visit(*c));
+    }
+    return std::make_shared<Function>(args,
+                                      derived().visit(*function.program()),
+                                      function.type(),
+                                      captures);
+  }
+  std::shared_ptr<Closure> visit(const Closure &closure) {
+    auto function = derived().visit(*closure.function());
+    auto captures = std::make_shared<IdentifierList>();
+    for(auto &c : *closure.captures()) {
+      captures->push_back(derived().visit(*c));
+    }
+    return std::make_shared<Closure>(function, captures, closure.type());
+  }
+  std::shared_ptr<Label> visit(const Label &label) {
+    return std::make_shared<Label>(label.name(),
+                                   derived().visit(*label.expression()));
+  }
+  std::shared_ptr<Application> visit(const Application &application) {
+    auto identifier = derived().visit(*application.identifier());
+    auto args = std::make_shared<Labels>();
+    for(auto &l : *application.labels()) {
+      args->insert({l.first, derived().visit(*l.second)});
+    }
+    return std::make_shared<Application>(identifier,
+                                         args,
+                                         application.function_type());
+  }
+  std::shared_ptr<Conditional> visit(const Conditional &conditional) {
+    auto expression = derived().visit(*conditional.expression());
+    auto true_block = derived().visit(*conditional.true_block());
+    auto false_block = derived().visit(*conditional.false_block());
+    return std::make_shared<Conditional>(expression, true_block, false_block);
+  }
+  std::shared_ptr<Loop> visit(const Loop &loop) {
+    auto count = derived().visit(*loop.count());
+    if(loop.counter() == nullptr) {
+      return std::make_shared<Loop>(count, derived().visit(*loop.program()));
+    }
+    auto counter = derived().visit(*loop.counter());
+    return std::make_shared<Loop>(count,
+                                  counter,
+                                  derived().visit(*loop.program()));
+  }
+  std::shared_ptr<Record> visit(const Record &record) {
+    auto fields = std::make_shared<Fields>();
+    for(auto &f : *record.fields()) {
+      fields->push_back(derived().visit(*f));
+    }
+    return std::make_shared<Record>(fields,
+                                    derived().visit(*record.base()),
+                                    record.type());
+  }
+  std::shared_ptr<Selection> visit(const Selection &selection) {
+    return std::make_shared<Selection>(derived().visit(*selection.record()),
+                                       selection.label(),
+                                       selection.type());
+  }
+  std::shared_ptr<Operation> visit(const Operation &operation) {
+    auto left = derived().visit(*operation.left());
+    auto right = derived().visit(*operation.right());
+    return std::make_shared<Operation>(left,
+                                       right,
+                                       operation.operation(),
+                                       operation.type());
+  }
+  std::shared_ptr<Declaration> visit(const Declaration &declaration) {
+    auto identifier = derived().visit(*declaration.identifier());
+    auto value = derived().visit(*declaration.value());
+    return std::make_shared<Declaration>(
+      identifier,
+      value,
+      derived().visit(*declaration.expression()));
+  }
+ private:
+  Derived &derived() { return static_cast<Derived &>(*this); }
+};
+
+}
+}
+
+#endif
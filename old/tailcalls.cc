@@ -0,0 +1,79 @@
+#include "node.hh"
+#include "tailcalls.hh"
+
+using namespace goat::node;
+using namespace goat::compiling;
+
+void TailCalls::descend(const Node &node, bool tail) {
+  auto outer = tail_;
+  tail_ = tail;
+  node.accept(*this);
+  tail_ = outer;
+}
+
+bool TailCalls::tail(const Application &application) const {
+  return calls_.find(&application) != calls_.end();
+}
+
+void TailCalls::visit(const Program &program) {
+  descend(*program.expression(), tail_);
+}
+
+void TailCalls::visit(const Argument &argument) {
+  descend(*argument.expression(), false);
+}
+
+void TailCalls::visit(const Function &function) {
+  for(auto a : *function.arguments()) {
+    a->accept(*this);
+  }
+  descend(*function.program(), true);
+}
+
+void TailCalls::visit(const Label &label) {
+  descend(*label.expression(), false);
+}
+
+void TailCalls::visit(const Application &application) {
+  if(tail_) {
+    calls_.insert(&application);
+  }
+  for(auto l : *application.labels()) {
+    l.second->accept(*this);
+  }
+}
+
+void TailCalls::visit(const Conditional &conditional) {
+  descend(*conditional.expression(), false);
+  descend(*conditional.true_block(), tail_);
+  descend(*conditional.false_block(), tail_);
+}
+
+void TailCalls::visit(const Loop &loop) {
+  descend(*loop.count(), false);
+  if(loop.counter() != nullptr) {
+    loop.counter()->accept(*this);
+  }
+  descend(*loop.program(), false);
+}
+
+void TailCalls::visit(const Record &record) {
+  for(auto f : *record.fields()) {
+    descend(*f, false);
+  }
+  descend(*record.base(), false);
+}
+
+void TailCalls::visit(const Selection &selection) {
+  descend(*selection.record(), false);
+}
+
+void TailCalls::visit(const Operation &operation) {
+  descend(*operation.left(), false);
+  descend(*operation.right(), false);
+}
+
+void TailCalls::visit(const Declaration &declaration) {
+  descend(*declaration.value(), false);
+  descend(*declaration.expression(), tail_);
+}
@@ -0,0 +1,41 @@
+#ifndef SRC_TAILCALLS_
+#define SRC_TAILCALLS_
+
+#include <set>
+
+#include "node.hh"
+#include "visitor.hh"
+
+namespace goat {
+namespace compiling {
+
+// Finds the applications whose result is the result of the function they
+// are in: the last expression of its program, looking through conditional
+// branches and the bodies of declarations.
+class TailCalls : public node::Visitor {
+public:
+  TailCalls() :
+    tail_(false),
+    calls_() {}
+  void visit(const node::Program &program);
+  void visit(const node::Argument &argument);
+  void visit(const node::Function &function);
+  void visit(const node::Label &label);
+  void visit(const node::Application &application);
+  void visit(const node::Conditional &conditional);
+  void visit(const node::Loop &loop);
+  void visit(const node::Record &record);
+  void visit(const node::Selection &selection);
+  void visit(const node::Operation &operation);
+  void visit(const node::Declaration &declaration);
+  bool tail(const node::Application &application) const;
+private:
+  void descend(const node::Node &node, bool tail);
+  bool tail_;
+  std::set<const node::Application *> calls_;
+};
+
+}
+}
+
+#endif
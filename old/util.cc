@@ -5,14 +5,66 @@
 using namespace goat::util;
 const char alpha[] = "abcdefghijklmnopqrstuvwxyz";
 std::string Namer::next() {
-  if(last_ == 0){ last_++; return "a"; }
-  uint32_t current = last_;
+  uint32_t current = last_->fetch_add(1);
+  if(current == 0){ return "a"; }
   std::string accum;
   while(current > 0) {
     uint8_t index = current % strlen(alpha);
     accum.push_back(alpha[index]);
     current /= strlen(alpha);
   }
-  last_++;
   return accum;
 }
+
+void Bitset::set(size_t bit) {
+  if(bit / 64 >= words_.size()) {
+    words_.resize(bit / 64 + 1);
+  }
+  words_[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+bool Bitset::test(size_t bit) const {
+  return bit / 64 < words_.size() &&
+    (words_[bit / 64] >> (bit % 64) & 1);
+}
+
+bool Bitset::empty() const {
+  return std::all_of(words_.begin(), words_.end(),
+                     [](uint64_t w) { return w == 0; });
+}
+
+void Bitset::truncate(size_t bit) {
+  if(bit / 64 >= words_.size()) {
+    return;
+  }
+  words_.resize(bit / 64 + 1);
+  words_.back() &= (uint64_t(1) << (bit % 64)) - 1;
+}
+
+Bitset &Bitset::operator|=(const Bitset &b) {
+  if(b.words_.size() > words_.size()) {
+    words_.resize(b.words_.size());
+  }
+  for(size_t i = 0; i < b.words_.size(); i++) {
+    words_[i] |= b.words_[i];
+  }
+  return *this;
+}
+
+Bitset &Bitset::operator&=(const Bitset &b) {
+  if(words_.size() > b.words_.size()) {
+    words_.resize(b.words_.size());
+  }
+  for(size_t i = 0; i < words_.size(); i++) {
+    words_[i] &= b.words_[i];
+  }
+  return *this;
+}
+
+Bitset &Bitset::subtract(const Bitset &b) {
+  auto n = std::min(words_.size(), b.words_.size());
+  for(size_t i = 0; i < n; i++) {
+    words_[i] &= ~b.words_[i];
+  }
+  return *this;
+}
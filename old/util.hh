@@ -2,6 +2,8 @@
 #define SRC_UTIL_H_
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <new>
 #include <tuple>
@@ -28,12 +30,38 @@ bool compare_vector_pointers(const T &a, const T &b) {
   return std::equal(a->begin(), a->end(), b->begin(), eq);
 }
 
+// A growable set of small integers packed 64 to a word.
+class Bitset {
+ public:
+  Bitset() : words_() {}
+  void set(size_t bit);
+  bool test(size_t bit) const;
+  bool empty() const;
+  // Clears every bit from `bit` upwards.
+  void truncate(size_t bit);
+  Bitset &operator|=(const Bitset &b);
+  Bitset &operator&=(const Bitset &b);
+  Bitset &subtract(const Bitset &b);
+  template <typename F>
+  void each(F f) const {
+    for(size_t w = 0; w < words_.size(); w++) {
+      for(uint64_t word = words_[w]; word; word &= word - 1) {
+        f(w * 64 + __builtin_ctzll(word));
+      }
+    }
+  }
+ private:
+  std::vector<uint64_t> words_;
+};
+
+// Hands out short unique names. Copies share the counter, so a pass split
+// across threads never hands out the same name twice.
 class Namer {
  public:
-  Namer() : last_(0) {}
+  Namer() : last_(std::make_shared<std::atomic<uint32_t>>(0)) {}
   std::string next();
  private:
-  uint32_t last_;
+  std::shared_ptr<std::atomic<uint32_t>> last_;
 };
 }
 }
@@ -1,6 +1,8 @@
+#include <functional>
 #include <memory>
 
 #include "node.hh"
+#include "pool.hh"
 #include "visitor.hh"
 
 using namespace goat::node;
@@ -39,6 +41,13 @@ void Visitor::visit(const Function &function) {
   function.program()->accept(*this);
 }
 
+void Visitor::visit(const Closure &closure) {
+  closure.function()->accept(*this);
+  for(auto c : *closure.captures()) {
+    c->accept(*this);
+  }
+}
+
 void Visitor::visit(const Label &label) {
   label.expression()->accept(*this);
 }
@@ -57,6 +66,25 @@ void Visitor::visit(const Conditional &conditional) {
   conditional.false_block()->accept(*this);
 }
 
+void Visitor::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  if(loop.counter() != nullptr) {
+    loop.counter()->accept(*this);
+  }
+  loop.program()->accept(*this);
+}
+
+void Visitor::visit(const Record &record) {
+  for(auto f : *record.fields()) {
+    f->accept(*this);
+  }
+  record.base()->accept(*this);
+}
+
+void Visitor::visit(const Selection &selection) {
+  selection.record()->accept(*this);
+}
+
 void Visitor::visit(const Operation &operation) {
   operation.left()->accept(*this);
   operation.right()->accept(*this);
@@ -70,11 +98,110 @@ void Visitor::visit(const Declaration &declaration) {
 
 
 
+namespace {
+// Counts the nodes under every node of a tree, keeping the big ones.
+class Measure : public Visitor {
+ public:
+  Measure(std::unordered_map<const Node *, size_t> &sizes, size_t threshold) :
+    sizes_(sizes),
+    threshold_(threshold),
+    count_(0) {}
+#define MEASURE(T)                                \
+  void visit(const T &node) {                     \
+    auto before = count_++;                       \
+    Visitor::visit(node);                         \
+    if(count_ - before >= threshold_) {           \
+      sizes_[&node] = count_ - before;            \
+    }                                             \
+  }
+  MEASURE(EmptyExpression)
+  MEASURE(Number)
+  MEASURE(Identifier)
+  MEASURE(String)
+  MEASURE(Program)
+  MEASURE(Argument)
+  MEASURE(Function)
+  MEASURE(Closure)
+  MEASURE(Label)
+  MEASURE(Application)
+  MEASURE(Conditional)
+  MEASURE(Loop)
+  MEASURE(Record)
+  MEASURE(Selection)
+  MEASURE(Operation)
+  MEASURE(Declaration)
+#undef MEASURE
+ private:
+  std::unordered_map<const Node *, size_t> &sizes_;
+  size_t threshold_;
+  size_t count_;
+};
+}
+
+void TreeCloner::parallel(goat::util::Pool *pool, size_t threshold) {
+  pool_ = pool;
+  threshold_ = threshold;
+}
+
 std::shared_ptr<Program> TreeCloner::clone(std::shared_ptr<Program> program) {
+  if(pool_ != nullptr) {
+    auto sizes = std::make_shared<Sizes>();
+    Measure measure(*sizes, threshold_);
+    program->accept(measure);
+    sizes_ = sizes;
+  }
   program->accept(*this);
+  sizes_ = nullptr;
   return std::static_pointer_cast<Program>(child_);
 }
 
+std::vector<std::shared_ptr<Node>>
+TreeCloner::fork(const std::vector<const Node *> &nodes) {
+  std::vector<std::shared_ptr<Node>> results(nodes.size());
+  std::vector<size_t> big;
+  if(pool_ != nullptr && sizes_ != nullptr) {
+    for(size_t i = 0; i < nodes.size(); i++) {
+      if(sizes_->count(nodes[i]) != 0) {
+        big.push_back(i);
+      }
+    }
+  }
+  std::vector<std::unique_ptr<TreeCloner>> copies;
+  for(size_t i = 0; big.size() > 1 && i < big.size(); i++) {
+    auto copy = split();
+    if(copy == nullptr) break;
+    copies.push_back(std::move(copy));
+  }
+  if(copies.size() < 2 || copies.size() != big.size()) {
+    for(size_t i = 0; i < nodes.size(); i++) {
+      nodes[i]->accept(*this);
+      results[i] = child_;
+    }
+    return results;
+  }
+
+  // The small ones go first, on this thread, while the big ones are stolen.
+  std::vector<std::function<void()>> tasks;
+  tasks.push_back([&]() {
+    for(size_t i = 0, b = 0; i < nodes.size(); i++) {
+      if(b < big.size() && big[b] == i) {
+        b++;
+        continue;
+      }
+      nodes[i]->accept(*this);
+      results[i] = child_;
+    }
+  });
+  for(size_t b = 0; b < big.size(); b++) {
+    tasks.push_back([&, b]() {
+      nodes[big[b]]->accept(*copies[b]);
+      results[big[b]] = copies[b]->child_;
+    });
+  }
+  pool_->run(std::move(tasks));
+  return results;
+}
+
 void TreeCloner::visit(const EmptyExpression &empty) {
   child_ = std::make_shared<EmptyExpression>();
 }
@@ -113,13 +240,31 @@ void TreeCloner::visit(const Function &function) {
     a->accept(*this);
     args->push_back(std::static_pointer_cast<Argument>(child_));
   }
+  auto captures = std::make_shared<IdentifierList>();
+  for(auto c : *function.captures()) {
+    c->accept(*this);
+    captures->push_back(std::static_pointer_cast<Identifier>(child_));
+  }
   function.program()->accept(*this);
   child_ = std::make_shared<Function>(
     args,
-    std::static_pointer_cast<Program>(child_)
+    std::static_pointer_cast<Program>(child_),
+    function.type(),
+    captures
   );
 }
 
+void TreeCloner::visit(const Closure &closure) {
+  closure.function()->accept(*this);
+  auto function = std::static_pointer_cast<Identifier>(child_);
+  auto captures = std::make_shared<IdentifierList>();
+  for(auto c : *closure.captures()) {
+    c->accept(*this);
+    captures->push_back(std::static_pointer_cast<Identifier>(child_));
+  }
+  child_ = std::make_shared<Closure>(function, captures, closure.type());
+}
+
 void TreeCloner::visit(const Label &label) {
   label.expression()->accept(*this);
   auto expression = std::static_pointer_cast<Node>(child_);
@@ -130,25 +275,64 @@ void TreeCloner::visit(const Application &application) {
   auto args = std::make_shared<Labels>();
   application.identifier()->accept(*this);
   auto ident = child_;
+  std::vector<const Node *> labels;
   for(auto l : *application.labels()) {
-    l.second->accept(*this);
-    auto label = std::static_pointer_cast<Label>(child_);
+    labels.push_back(l.second.get());
+  }
+  for(auto l : fork(labels)) {
+    auto label = std::static_pointer_cast<Label>(l);
     args->insert({label->name(), label});
   }
   child_ = std::make_shared<Application>(
     std::static_pointer_cast<Identifier>(ident),
-    args
+    args,
+    application.function_type()
   );
 }
 
 void TreeCloner::visit(const Conditional &conditional) {
-  conditional.expression()->accept(*this);
-  auto expression = child_;
-  conditional.true_block()->accept(*this);
-  auto true_block = std::static_pointer_cast<Program>(child_);
-  conditional.false_block()->accept(*this);
-  auto false_block = std::static_pointer_cast<Program>(child_);
-  child_ = std::make_shared<Conditional>(expression, true_block, false_block);
+  auto parts = fork({conditional.expression().get(),
+                     conditional.true_block().get(),
+                     conditional.false_block().get()});
+  child_ = std::make_shared<Conditional>(
+    parts[0],
+    std::static_pointer_cast<Program>(parts[1]),
+    std::static_pointer_cast<Program>(parts[2])
+  );
+}
+
+void TreeCloner::visit(const Loop &loop) {
+  loop.count()->accept(*this);
+  auto count = child_;
+  std::shared_ptr<Argument> counter;
+  if(loop.counter() != nullptr) {
+    loop.counter()->accept(*this);
+    counter = std::static_pointer_cast<Argument>(child_);
+  }
+  loop.program()->accept(*this);
+  auto program = std::static_pointer_cast<Program>(child_);
+  if(counter) {
+    child_ = std::make_shared<Loop>(count, counter, program);
+  } else {
+    child_ = std::make_shared<Loop>(count, program);
+  }
+}
+
+void TreeCloner::visit(const Record &record) {
+  auto fields = std::make_shared<Fields>();
+  for(auto f : *record.fields()) {
+    f->accept(*this);
+    fields->push_back(std::static_pointer_cast<Label>(child_));
+  }
+  record.base()->accept(*this);
+  child_ = std::make_shared<Record>(fields, child_, record.type());
+}
+
+void TreeCloner::visit(const Selection &selection) {
+  selection.record()->accept(*this);
+  child_ = std::make_shared<Selection>(child_,
+                                       selection.label(),
+                                       selection.type());
 }
 
 void TreeCloner::visit(const Operation &operation) {
@@ -156,15 +340,16 @@ void TreeCloner::visit(const Operation &operation) {
   auto left = child_;
   operation.right()->accept(*this);
   auto right = child_;
-  child_ = std::make_shared<Operation>(left, right, operation.operation());
+  child_ = std::make_shared<Operation>(left,
+                                       right,
+                                       operation.operation(),
+                                       operation.type());
 }
 
 void TreeCloner::visit(const Declaration &declaration) {
   declaration.identifier()->accept(*this);
   auto ident = std::static_pointer_cast<Identifier>(child_);
-  declaration.value()->accept(*this);
-  auto value = child_;
-  declaration.expression()->accept(*this);
-  auto expr = child_;
-  child_ = std::make_shared<Declaration>(ident, value, expr);
+  auto parts = fork({declaration.value().get(),
+                     declaration.expression().get()});
+  child_ = std::make_shared<Declaration>(ident, parts[0], parts[1]);
 }
@@ -2,8 +2,14 @@
 #define GOAT_VISITOR_HH
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace goat {
+namespace util {
+class Pool;
+}
+
 namespace node {
 
 class Node;
@@ -14,9 +20,13 @@ class String;
 class Program;
 class Argument;
 class Function;
+class Closure;
 class Label;
 class Application;
 class Conditional;
+class Loop;
+class Record;
+class Selection;
 class Operation;
 class Declaration;
 
@@ -28,9 +38,13 @@ class Declaration;
   void visit(const node::Program &program); \
   void visit(const node::Argument &argument); \
   void visit(const node::Function &function); \
+  void visit(const node::Closure &closure); \
   void visit(const node::Label &label); \
   void visit(const node::Application &application); \
   void visit(const node::Conditional &conditional); \
+  void visit(const node::Loop &loop); \
+  void visit(const node::Record &record); \
+  void visit(const node::Selection &selection); \
   void visit(const node::Operation &operation); \
   void visit(const node::Declaration &declaration);
 
@@ -44,9 +58,13 @@ public:
   virtual void visit(const node::Program &program);
   virtual void visit(const node::Argument &argument);
   virtual void visit(const node::Function &function);
+  virtual void visit(const node::Closure &closure);
   virtual void visit(const node::Label &label);
   virtual void visit(const node::Application &application);
   virtual void visit(const node::Conditional &conditional);
+  virtual void visit(const node::Loop &loop);
+  virtual void visit(const node::Record &record);
+  virtual void visit(const node::Selection &selection);
   virtual void visit(const node::Operation &operation);
   virtual void visit(const node::Declaration &declaration);
 };
@@ -58,9 +76,20 @@ void list_accept(const T list, node::Visitor &v) {
   }
 }
 
+// Copies a tree, letting passes replace the nodes they care about.
+//
+// Given a pool, independent subtrees (the value and body of a declaration,
+// label expressions and the parts of a conditional) with at least
+// `threshold` nodes are cloned on it in parallel, each by a copy of the pass
+// made with split(). Passes opt in by overriding split.
 class TreeCloner : public Visitor {
 public:
-  TreeCloner() : child_(nullptr) {}
+  TreeCloner() :
+    child_(nullptr),
+    pool_(nullptr),
+    threshold_(0),
+    sizes_() {}
+  void parallel(util::Pool *pool, size_t threshold = 512);
   virtual void visit(const node::EmptyExpression &empty);
   virtual void visit(const node::Number &number);
   virtual void visit(const node::Identifier &identifier);
@@ -68,14 +97,30 @@ public:
   virtual void visit(const node::Program &program);
   virtual void visit(const node::Argument &argument);
   virtual void visit(const node::Function &function);
+  virtual void visit(const node::Closure &closure);
   virtual void visit(const node::Label &label);
   virtual void visit(const node::Application &application);
   virtual void visit(const node::Conditional &conditional);
+  virtual void visit(const node::Loop &loop);
+  virtual void visit(const node::Record &record);
+  virtual void visit(const node::Selection &selection);
   virtual void visit(const node::Operation &operation);
   virtual void visit(const node::Declaration &declaration);
   std::shared_ptr<node::Program> clone(std::shared_ptr<node::Program> program);
 protected:
+  using Sizes = std::unordered_map<const node::Node *, size_t>;
+  // A copy of this pass to clone a subtree on another thread, or null if
+  // the pass can't be split.
+  virtual std::unique_ptr<TreeCloner> split() const { return nullptr; }
+  // Clones each node, the big ones in parallel when there is a pool.
+  std::vector<std::shared_ptr<node::Node>>
+  fork(const std::vector<const node::Node *> &nodes);
   std::shared_ptr<node::Node> child_;
+private:
+  util::Pool *pool_;
+  size_t threshold_;
+  // Sizes of the subtrees big enough to fork, shared with split copies.
+  std::shared_ptr<const Sizes> sizes_;
 };
 
 }
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+
+#include "vm.hh"
+
+using namespace goat::bytecode;
+
+bool Machine::run(const Module &module, double &value) {
+  static void *handlers[] = {
+    &&constant,
+    &&move,
+    &&add,
+    &&subtract,
+    &&multiply,
+    &&divide,
+    &&less,
+    &&truncate,
+    &&jump,
+    &&jump_if_zero,
+    &&call,
+    &&tail_call,
+    &&ret,
+  };
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) == Opcodes,
+                "every opcode has a handler");
+
+  const double *constants = module.constants.data();
+  const Function *function = &module.functions[module.main];
+  size_t base = 0;
+  registers_.assign(function->registers, 0);
+  frames_.clear();
+  double *r = registers_.data();
+  const Instruction *ip = function->code.data();
+  // Only jumps and calls can keep a program going, so only they burn it.
+  auto fuel = fuel_;
+
+#define DISPATCH() goto *handlers[ip->op]
+#define NEXT() do { ip++; DISPATCH(); } while(0)
+
+  DISPATCH();
+
+constant:
+  r[ip->a] = constants[ip->b];
+  NEXT();
+move:
+  r[ip->a] = r[ip->b];
+  NEXT();
+add:
+  r[ip->a] = r[ip->b] + r[ip->c];
+  NEXT();
+subtract:
+  r[ip->a] = r[ip->b] - r[ip->c];
+  NEXT();
+multiply:
+  r[ip->a] = r[ip->b] * r[ip->c];
+  NEXT();
+divide:
+  r[ip->a] = r[ip->b] / r[ip->c];
+  NEXT();
+less:
+  r[ip->a] = r[ip->b] < r[ip->c] ? 1 : 0;
+  NEXT();
+truncate:
+  r[ip->a] = std::trunc(r[ip->b]);
+  NEXT();
+jump:
+  if(fuel-- == 0) return false;
+  ip = function->code.data() + ip->b;
+  DISPATCH();
+jump_if_zero:
+  // NaN is false too, as it is in compiled code.
+  if(!(r[ip->a] < 0 || r[ip->a] > 0)) {
+    ip = function->code.data() + ip->b;
+    DISPATCH();
+  }
+  NEXT();
+call:
+  if(fuel-- == 0 || frames_.size() == depth_) return false;
+  frames_.push_back({function, ip + 1, base, ip->a});
+  base += ip->c;
+  function = &module.functions[ip->b];
+  goto enter;
+tail_call: {
+  if(fuel-- == 0) return false;
+  auto callee = &module.functions[ip->b];
+  for(uint16_t i = 0; i < callee->params; i++) {
+    r[i] = r[ip->c + i];
+  }
+  function = callee;
+  goto enter;
+}
+enter:
+  // Growing may move the registers, so r is refreshed after.
+  if(registers_.size() < base + function->registers) {
+    registers_.resize(std::max(base + function->registers,
+                               registers_.size() * 2));
+  }
+  r = registers_.data() + base;
+  ip = function->code.data();
+  DISPATCH();
+ret: {
+  if(frames_.empty()) {
+    value = r[ip->a];
+    return true;
+  }
+  auto result = r[ip->a];
+  auto frame = frames_.back();
+  frames_.pop_back();
+  function = frame.function;
+  base = frame.base;
+  r = registers_.data() + base;
+  r[frame.result] = result;
+  ip = frame.return_to;
+  DISPATCH();
+}
+
+#undef NEXT
+#undef DISPATCH
+}
@@ -0,0 +1,42 @@
+#ifndef SRC_VM_
+#define SRC_VM_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bytecode.hh"
+
+namespace goat {
+namespace bytecode {
+
+// Runs assembled bytecode, dispatching with computed gotos so each
+// instruction jumps straight to the next one's handler.
+class Machine {
+ public:
+  // Gives up after `fuel` jumps and calls or `depth` nested calls.
+  Machine(uint64_t fuel = UINT64_MAX, size_t depth = SIZE_MAX) :
+    fuel_(fuel),
+    depth_(depth),
+    registers_(),
+    frames_() {}
+  // False if the program ran out of fuel or frames.
+  bool run(const Module &module, double &value);
+ private:
+  struct Frame {
+    const Function *function;
+    const Instruction *return_to;
+    size_t base;
+    // Where the caller wants the result, relative to its own base.
+    uint16_t result;
+  };
+  uint64_t fuel_;
+  size_t depth_;
+  std::vector<double> registers_;
+  std::vector<Frame> frames_;
+};
+
+}
+}
+
+#endif